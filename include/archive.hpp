@@ -0,0 +1,135 @@
+//
+//  file:       archive.hpp
+//
+//  project:    Multiple Wave Tracking
+//
+//  contents:   Declaration of the wave archive, an append-only binary log of
+//              the summaries of recognized waves, and of its writer and
+//              reader.  Uses POSIX file and memory-mapping APIs.
+//
+//  use:        see readme.txt
+//
+
+#ifndef archive_hpp
+#define archive_hpp
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "wave_objects.hpp"
+
+namespace archive {
+
+// An archive file begins with a header of kArchiveMagic and the format
+// version, and is followed by records.  Each record is the length of its
+// payload, the payload (one WaveSummary, encoded field by field), and a
+// checksum of the payload, so that a record torn by a crash mid-write is
+// detected and ignored by readers.  Records are only ever appended, so
+// everything before a torn record is intact.  Every integer in the file is
+// little-endian and of fixed width, so an archive reads the same on any
+// host, whatever the compiler's layout of WaveSummary.
+
+// Writes summaries of recognized waves to the end of an archive file from a
+// background thread, so that the tracking loop never waits on the disk.
+// Summaries appended between two writes are written as one batch and made
+// durable with a single fsync, at most about a second after being appended.
+// Memory stays constant however long the program runs, and the waves written
+// so far survive a crash of the program.  If a batch fails to be written, the
+// archive is cut back to its last synced record, and the batch stays pending
+// and is retried with the next batch, so that a full disk loses no waves once
+// space is freed; pending summaries then take memory until they are written.
+class ArchiveWriter {
+  public:
+    // Opens the archive at path for appending, creating it if it does not
+    // exist, and starts the writing thread.
+    explicit ArchiveWriter(const std::string& path);
+
+    // Writes and syncs any pending summaries, and closes the archive.
+    ~ArchiveWriter();
+
+    ArchiveWriter(const ArchiveWriter&) = delete;
+    ArchiveWriter& operator=(const ArchiveWriter&) = delete;
+
+    // Whether the archive was opened successfully.
+    bool is_open() const {return fd_ != -1;}
+
+    // Queues a summary to be written to the archive.
+    void append(const wave_obj::WaveSummary& summary);
+
+    // Blocks until every summary appended so far is written and synced, or
+    // until writing them fails.  Returns the number of summaries that are not
+    // yet written, which is zero unless writing failed.
+    long long flush();
+
+  private:
+    // Body of the writing thread.
+    void run();
+
+    // File descriptor of the archive, or -1 if it failed to open.
+    int fd_;
+
+    // Summaries appended but not yet taken by the writing thread.
+    std::vector<wave_obj::WaveSummary> pending_;
+
+    // Number of summaries appended, and of summaries written and synced.
+    long long appended_;
+    long long synced_;
+
+    // Length of the archive up to its last synced record.
+    off_t synced_length_;
+
+    // Whether the last write failed.
+    bool failed_;
+
+    // Whether the writing thread should write without waiting for a batch to
+    // fill, and whether it should finish.
+    bool flush_requested_;
+    bool stopping_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable synced_cond_;
+    std::thread thread_;
+};
+
+// Reads an archive by memory-mapping it.  Records are located once, on
+// opening, and read in place; reading stops at the first torn or corrupt
+// record.
+class ArchiveReader {
+  public:
+    // Maps the archive at path and locates its records.
+    explicit ArchiveReader(const std::string& path);
+
+    // Unmaps the archive.
+    ~ArchiveReader();
+
+    ArchiveReader(const ArchiveReader&) = delete;
+    ArchiveReader& operator=(const ArchiveReader&) = delete;
+
+    // Whether the archive was mapped and has a valid header.
+    bool is_open() const {return is_open_;}
+
+    // Number of intact records.
+    int size() const {return static_cast<int>(offsets_.size());}
+
+    // Returns the summary in record i.
+    wave_obj::WaveSummary at(int i) const;
+
+  private:
+    // Mapping of the archive, and its length in bytes.
+    const unsigned char* data_;
+    size_t length_;
+    bool is_open_;
+
+    // Offset of the payload of each intact record.
+    std::vector<size_t> offsets_;
+};
+
+}   // namespace archive
+
+#endif /* archive_hpp */
@@ -24,14 +24,62 @@
 
 namespace detection {
 
+// Foreground components of one frame, labeled outside the claimed bands.
+// DetectionDue() labels a frame when a large amount of foreground appears
+// ahead of schedule, and keeps the components here, so that DetectSections()
+// of the same frame does not label it again.  Owned by the caller, and reused
+// from frame to frame.
+struct Components {
+    Components(): labeled(false), moments() {}
+    
+    // Whether the components below are those of the current frame.
+    bool labeled;
+    
+    // Moments of each component, in raster order of its first pixel.
+    std::vector<wave_obj::PixelMoments> moments;
+};
+
 // Accepts a binarized, preprocessed image from the preprocessing routine and
-// detects waves.  Utilizes OpenCV functions for finding contours of a certain
-// size and shape as defined by constants in associated source file, and creates
-// wave objects from contours that meet the thresholds.  Returns a vector of
-// these waves.  Wave objects are handled (destroyed) in the tracking routine.
-// Detection has been measured to consume about 2% of CPU processing time in
-// execution.
-std::vector<wave_obj::Wave> DetectSections(const cv::Mat&, int);
+// detects waves.  Labels connected foreground components in a single raster
+// pass, accumulating their moments as it goes, filters them for a certain size
+// and shape as defined by constants in associated source file, and creates
+// Section records from components that meet the thresholds.  Returns a vector
+// of these sections, which the tracking routine promotes to Wave objects only
+// if they are not part of a wave that is already being tracked.  Frames of
+// preprocessing::kMinParallelArea or more, which include every analysis
+// frame, are labeled in horizontal tiles on OpenCV's thread pool and merged
+// across tile borders, with output identical to the serial labeling.
+// Foreground inside the claimed bands (the union of the search bands of
+// tracked waves, See: tracking::BandIndex::claimed) is not labeled, so that
+// detection cost is proportional to foam that is not yet tracked, except in
+// bands that untracked foreground touches.  Those bands are labeled too, so
+// that every component holds all of the foam connected to it, as it would
+// without claims.  A component that reaches into a band then becomes a new
+// wave only if its center of mass lies outside the claimed bands (See:
+// tracking::AddNewSectionsToTrackedWaves): the spill of a tracked wave past
+// its band does not, and a new wave whose foam has merged with that of a
+// tracked wave does once it outweighs it.  If given the components of the
+// frame, labeled by DetectionDue() with the same claimed bands, they are used
+// instead of labeling the frame.  Detection has been measured to consume
+// about 2% of CPU processing time in execution.
+std::vector<wave_obj::Section> DetectSections(
+        const cv::Mat&, int,
+        const std::vector<cv::Range>& = std::vector<cv::Range>(),
+        const Components* = 0);
+
+// New waves enter the scene a few times a minute, while waves already in the
+// scene are followed by the tracking routine on every frame.  Decides whether
+// birth detection needs to run on the current frame, given the claimed bands,
+// the number of frames since DetectSections() last ran, and the cadence in
+// frames at which it is scheduled.  Detection is skipped when there is too
+// little untracked foreground to make up a section, and is run ahead of
+// schedule when a large amount of untracked foreground appears.  Only
+// components whose centers of mass lie outside the claimed bands count
+// towards running detection ahead of schedule.  The components it labels to
+// decide are kept in the given Components, which are marked as unlabeled when
+// it decides without labeling.
+bool DetectionDue(const cv::Mat&, const std::vector<cv::Range>&, int, int,
+                  Components&);
 
 } // namespace detection
 
@@ -0,0 +1,145 @@
+//
+//  file:       events.hpp
+//
+//  project:    Multiple Wave Tracking
+//
+//  contents:   Declaration of the events of the life of a tracked wave, of the
+//              queue that carries them out of the tracking routine, and of
+//              the dispatcher that delivers them to an observer.
+//
+//  use:        see readme.txt
+//
+
+#ifndef events_hpp
+#define events_hpp
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace events {
+
+// Stages of the life of a tracked wave.  A wave is born when a detected
+// section is promoted to a tracked wave, is recognized in the frame in which it
+// first meets the mass and displacement thresholds, and dies when it is no
+// longer tracked, either because it has no pixels left, because the sequence
+// ended, or because it turned out to be a duplicate of an older wave.
+enum EventType {kBirth, kRecognition, kDeath};
+
+// WaveEvent is the compact, fixed-size record of one event in the life of a
+// wave.  It holds a copy of the wave's state at the time of the event, so
+// consumers never touch the tracked waves themselves.
+struct WaveEvent {
+    // Kind of event, and the name of the wave.
+    EventType type;
+    int name;
+
+    // Frame of the event.
+    int frame;
+
+    // Center of mass of the wave, or (-1,-1) if it has no pixels.
+    int centroid_x;
+    int centroid_y;
+
+    // Instantaneous and maximum mass, and maximum displacement of the wave.
+    int mass;
+    int max_mass;
+    int max_displacement;
+
+    // Whether the wave is recognized.
+    bool recognized;
+};
+
+static_assert(std::is_trivially_copyable<WaveEvent>::value,
+              "WaveEvent must remain trivially copyable");
+
+// Lock-free, bounded queue of events from one producer to one consumer.  The
+// tracking routine pushes events as they happen, and never waits on the
+// consumer: when the queue is full the event is dropped and counted instead.
+// The producing stages of a frame may run on different threads, provided no
+// two of them push concurrently (See: pipeline::TaskGraph).
+class EventQueue {
+  public:
+    // Makes a queue for at least capacity events.
+    explicit EventQueue(int capacity = 1024);
+
+    EventQueue(const EventQueue&) = delete;
+    EventQueue& operator=(const EventQueue&) = delete;
+
+    // Producer: adds an event to the queue.  Returns false, dropping the
+    // event, if the queue is full.
+    bool push(const WaveEvent& event);
+
+    // Consumer: takes the oldest event from the queue.  Returns false if the
+    // queue is empty.
+    bool pop(WaveEvent& event);
+
+    // Number of events dropped because the queue was full.
+    long long dropped() const {return dropped_.load();}
+
+  private:
+    // Ring of events; its size is a power of two.
+    std::vector<WaveEvent> slots_;
+    size_t mask_;
+
+    // Count of events taken, written only by the consumer, and of events
+    // added, written only by the producer.  Kept on separate cache lines so
+    // the two threads do not contend for them.
+    alignas(64) std::atomic<size_t> head_;
+    alignas(64) std::atomic<size_t> tail_;
+
+    std::atomic<long long> dropped_;
+};
+
+// Interface for reacting to the events of tracked waves.  Override the events
+// of interest; the others are ignored.
+class WaveObserver {
+  public:
+    virtual ~WaveObserver() {}
+    virtual void on_birth(const WaveEvent&) {}
+    virtual void on_recognition(const WaveEvent&) {}
+    virtual void on_death(const WaveEvent&) {}
+};
+
+// Delivers the events of a queue to an observer, in order, on a thread of its
+// own.  The thread sleeps until the producer notifies it that events were
+// pushed, so it neither polls the queue nor slows the tracking routine.
+class EventDispatcher {
+  public:
+    // Starts delivering the events of the queue to the observer.
+    EventDispatcher(EventQueue& queue, WaveObserver& observer);
+
+    // Delivers the events left in the queue, and stops.
+    ~EventDispatcher();
+
+    EventDispatcher(const EventDispatcher&) = delete;
+    EventDispatcher& operator=(const EventDispatcher&) = delete;
+
+    // Producer: wakes the dispatching thread to deliver the events pushed so
+    // far.
+    void notify();
+
+  private:
+    // Body of the dispatching thread.
+    void run();
+
+    EventQueue& queue_;
+    WaveObserver& observer_;
+
+    // Whether events were pushed since the thread last woke, and whether it
+    // should finish.
+    bool signaled_;
+    bool stopping_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::thread thread_;
+};
+
+}   // namespace events
+
+#endif /* events_hpp */
@@ -0,0 +1,120 @@
+//
+//  file:       pipeline.hpp
+//
+//  project:    Multiple Wave Tracking
+//
+//  contents:   Declaration of the task graph that runs the stages of the
+//              analysis of one frame.
+//
+//  use:        see readme.txt
+//
+
+#ifndef pipeline_hpp
+#define pipeline_hpp
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pipeline {
+
+// A directed acyclic graph of the stages of the analysis of a frame.  Each
+// node is a task that runs once per frame after the nodes it depends on.  The
+// graph is built once and run on every frame; its tasks read and write the
+// state of the analysis through the references they capture.
+//
+// Nodes are run level by level, where the level of a node is one more than the
+// deepest of its dependencies.  Nodes on the same level do not depend on each
+// other.  A node may be given a check of whether it has work in the current
+// run; nodes without work are skipped.  A level with one node to run runs it
+// on the calling thread, so the parallel loops inside the task keep OpenCV's
+// whole thread pool.  The nodes of a wider level run concurrently, one on the
+// calling thread and the others on helper threads owned by the graph, rather
+// than inside an OpenCV parallel loop, whose nested loops would run serially.
+// The time each node takes, including its check, is recorded for every run.
+class TaskGraph {
+  public:
+    TaskGraph(): nodes_(), levels_(), runs_(0), active_(), queued_(),
+                 unfinished_(0), stopping_(false) {}
+
+    // Stops the helper threads.
+    ~TaskGraph();
+
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+
+    // Adds a node that runs the task once its dependencies, which must be
+    // nodes already in the graph, have run.  If has_work is given, it is
+    // called on the calling thread once the dependencies have run, and the
+    // task only runs if it returns true.  Returns the id of the node.
+    int add_node(const std::string& name,
+                 const std::function<void()>& task,
+                 const std::vector<int>& dependencies = std::vector<int>(),
+                 const std::function<bool()>& has_work =
+                         std::function<bool()>());
+
+    // Runs every node of the graph once.
+    void run();
+
+    // Number of nodes in the graph, and number of runs of the graph.
+    int size() const {return static_cast<int>(nodes_.size());}
+    int runs() const {return runs_;}
+
+    // Name of a node, and the time it took in the last run and in all runs, in
+    // milliseconds.
+    const std::string& name(int node) const {return nodes_[node].name;}
+    double last_milliseconds(int node) const {return nodes_[node].last_ms;}
+    double total_milliseconds(int node) const {return nodes_[node].total_ms;}
+
+  private:
+    struct Node {
+        std::string name;
+        std::function<void()> task;
+        std::function<bool()> has_work;
+        int level;
+        double last_ms;
+        double total_ms;
+    };
+
+    // Asks a node whether it has work in this run, and records the time the
+    // check took.
+    bool check_node(int node);
+
+    // Runs one node and adds its time to the time of its check.
+    void run_node(int node);
+
+    // Runs the active nodes of a level concurrently.
+    void run_concurrently();
+
+    // Body of a helper thread.
+    void help();
+
+    std::vector<Node> nodes_;
+
+    // Ids of the nodes on each level, in order of addition.
+    std::vector<std::vector<int>> levels_;
+
+    int runs_;
+
+    // Nodes of the current level with work, and those of them waiting for a
+    // helper thread.
+    std::vector<int> active_;
+    std::vector<int> queued_;
+
+    // Number of nodes handed to helper threads that have not finished, and
+    // whether the helper threads should finish.
+    int unfinished_;
+    bool stopping_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable finished_;
+    std::vector<std::thread> helpers_;
+};
+
+}   // namespace pipeline
+
+#endif /* pipeline_hpp */
@@ -21,6 +21,17 @@
 
 namespace preprocessing {
 
+// Size of the analysis frames that Preprocess() returns.  The detection and
+// tracking routines work in the coordinates of these frames.
+const int kAnalysisWidth = 320;
+const int kAnalysisHeight = 180;
+
+// Analysis frames of at least this many pixels are labeled by the detection
+// routine, and swept by the tracking routine, in horizontal stripes on
+// OpenCV's thread pool.  Equal to the area of an analysis frame, so that the
+// parallel paths are the ones that run.
+const int kMinParallelArea = kAnalysisWidth*kAnalysisHeight;
+
 // Initializes two objects needed for preprocessing frames of an OpenCV
 // VideoReader object: 1. A background subtractor object for modeling scene
 // background and extracting foreground, and 2. A kernel represented as a
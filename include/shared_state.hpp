@@ -0,0 +1,133 @@
+//
+//  file:       shared_state.hpp
+//
+//  project:    Multiple Wave Tracking
+//
+//  contents:   Declaration of the shared-memory snapshot of the tracked waves
+//              that the Multiple Wave Tracking program publishes each frame,
+//              and of its publisher and reader.  Uses POSIX shared memory
+//              APIs.  Does not depend on OpenCV, so that other processes can
+//              read snapshots by linking only the mwt_state library.
+//
+//  use:        see readme.txt
+//
+
+#ifndef shared_state_hpp
+#define shared_state_hpp
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace shared_state {
+
+// Most waves a snapshot holds.  Waves beyond it are counted but not listed.
+const int kMaxSnapshotWaves = 256;
+
+// State of one tracked wave in a snapshot.
+struct WaveState {
+    // Name of the wave.
+    int32_t name;
+
+    // Center of mass of the wave, or (-1,-1) if it has no pixels.
+    int32_t centroid_x;
+    int32_t centroid_y;
+
+    // Instantaneous mass of the wave.
+    int32_t mass;
+
+    // 1 if the wave is recognized, 0 otherwise.
+    int32_t recognized;
+};
+
+// Snapshot of the tracked waves at the end of a frame.
+struct Snapshot {
+    // Frame of the snapshot, or 0 before the first frame is published.
+    int32_t frame;
+
+    // Number of tracked waves, and number of them listed in waves.
+    int32_t num_tracked;
+    int32_t num_waves;
+
+    WaveState waves[kMaxSnapshotWaves];
+};
+
+static_assert(std::is_trivially_copyable<Snapshot>::value,
+              "Snapshot must remain trivially copyable");
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+              "The snapshot sequence must be lock-free to be shared");
+
+// The shared-memory segment holds a header of kStateMagic, the layout version,
+// the process id of the publisher and a sequence number, followed by one
+// Snapshot.  The sequence number is a
+// seqlock: the publisher makes it odd while it writes the snapshot and even
+// again when it is done.  A reader copies the snapshot out between two reads
+// of the sequence, and keeps the copy only if the sequence was the same even
+// number both times.  The publisher never waits on readers, and readers never
+// see a torn snapshot.
+
+// Layout of the shared-memory segment (See: shared_state.cpp).
+struct Segment;
+
+// Publishes snapshots of the tracked waves to a named shared-memory segment.
+class StatePublisher {
+  public:
+    // Creates the segment with the given name (e.g. "/mwt_state") and maps
+    // it for writing.  A segment of that name is never shared with another
+    // publisher: one left by a publisher that is no longer running is
+    // replaced, and any other makes the publisher fail to open (See:
+    // in_use).
+    explicit StatePublisher(const std::string& name);
+
+    // Unmaps the segment and removes its name.
+    ~StatePublisher();
+
+    StatePublisher(const StatePublisher&) = delete;
+    StatePublisher& operator=(const StatePublisher&) = delete;
+
+    // Whether the segment was created and mapped successfully.
+    bool is_open() const {return segment_ != 0;}
+
+    // Whether the segment could not be created because a segment of the same
+    // name exists that another running publisher may be writing to.
+    bool in_use() const {return in_use_;}
+
+    // Writes a snapshot of the waves for the frame.  Never blocks.
+    void publish(int frame_number, const std::vector<WaveState>& waves);
+
+  private:
+    std::string name_;
+    Segment* segment_;
+    bool in_use_;
+};
+
+// Reads snapshots from a named shared-memory segment written by a
+// StatePublisher, possibly in another process.
+class StateReader {
+  public:
+    // Opens the segment with the given name and maps it for reading.
+    explicit StateReader(const std::string& name);
+
+    // Unmaps the segment.
+    ~StateReader();
+
+    StateReader(const StateReader&) = delete;
+    StateReader& operator=(const StateReader&) = delete;
+
+    // Whether the segment was mapped and has a valid header.
+    bool is_open() const {return segment_ != 0;}
+
+    // Copies the latest complete snapshot into snapshot.  Returns false if no
+    // consistent copy could be taken after a few attempts, such as when the
+    // publisher stopped in the middle of a write.
+    bool read(Snapshot& snapshot) const;
+
+  private:
+    const Segment* segment_;
+};
+
+}   // namespace shared_state
+
+#endif /* shared_state_hpp */
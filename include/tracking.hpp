@@ -22,42 +22,157 @@
 #include "opencv2/opencv.hpp"
 #include "wave_objects.hpp"
 
+namespace events {
+class EventQueue;
+}
+
 
 namespace tracking {
 
+// Scratch storage of the tracking routine (See: below).
+struct TrackingBuffers;
+
+// Predicts the motion of each wave from its recent centroids and updates the
+// region of interest in which to search for its representation in the next
+// frame around the prediction, as narrow as the wave's spread and the
+// prediction's uncertainty allow.  Needs no frame, so the search bands of a
+// frame are known, and can be handed to detection, before the frame is
+// tracked.  Must be called before TrackWaves on every frame.
+void PredictSearchRegions(wave_obj::WavePool&);
+
+// Source of the moments of the waves' representations in the tracking
+// routine, when their runs are not kept: the sweep of their search bands
+// (See: wave_obj::UpdateAllPoints), or lookups in band sums of the frame
+// (See: wave_obj::BandSums).  The sweep costs the area of the search bands;
+// the band sums cost one pass over the whole frame, however many waves are
+// tracked, plus constant time per wave.  Automatic selection takes band sums
+// only on frames whose search bands cover a sizeable fraction of the frame.
+enum MomentSource {
+    kAutoMoments,
+    kSweepMoments,
+    kBandSumMoments
+};
+
+// Options of the tracking routine.  Waves keep their runs only for a renderer
+// that wants exact bounding boxes, and then their moments always come from
+// the sweep that finds the runs.
+struct TrackOptions {
+    TrackOptions(): keep_runs(false), moment_source(kAutoMoments) {}
+    
+    bool keep_runs;
+    MomentSource moment_source;
+};
+
 // Main function for tracking Wave objects through successive, preprocessed
-// frames of an OpenCV VideoReader object.  Calls all member functions of the
-// Wave object that begin with 'update*'.  These member functions define a new
-// region of interest in which to search for the wave's representation in
-// successive frames, identifies this representation, and updates its data
-// accordingly.  TrackWaves and associated functions below have been measured
-// to consume about 4% of CPU processing time in execution.
-void TrackWaves(std::vector<wave_obj::Wave>&,
+// frames of an OpenCV VideoReader object.  Identifies the representations of
+// all waves in their predicted search regions (See: PredictSearchRegions
+// above) in a single pass over the frame, from the source of moments of the
+// given options (See: MomentSource).  The centroid, displacement, mass and
+// recognition of every wave are then updated from its moments at once, in the
+// pool's table (See: wave_obj::WaveTable).  Display-only geometry is not
+// computed here.  Frames with no tracked waves are not read at all.  On frames
+// of preprocessing::kMinParallelArea or more, which include every analysis
+// frame, either pass is split into horizontal stripes on OpenCV's thread
+// pool, with results identical to a serial pass.
+// If given an event queue, a recognition event is pushed to it for each wave
+// that becomes recognized (See: events::WaveEvent).  Scratch storage is kept
+// in the given buffers from frame to frame.  The cost of tracking is reported
+// with the "track" stage timing of each run.
+void TrackWaves(wave_obj::WavePool&,
                 const cv::Mat&,
-                int, int);
+                int, int,
+                TrackingBuffers&,
+                const TrackOptions& = TrackOptions(),
+                events::EventQueue* = 0);
+
+// Identifies when a wave no longer exists by checking its death() frame, and
+// destroys it in the pool of tracked waves, returning its state to the pool.
+// If the wave became recognized in the tracking routine, its summary (See:
+// wave_obj::WaveSummary) is first appended to a separate vector that holds the
+// records of recognized waves.  If given an event queue, a death event is
+// pushed to it for each dead wave.
+void RemoveDeadWaves(wave_obj::WavePool&, std::vector<wave_obj::WaveSummary>&,
+                     events::EventQueue* = 0);
+
+// Index of the search bands of tracked waves, as sorted, disjoint ranges of
+// band intercepts (See: wave_obj::BandIntercept).  Answers whether any band
+// covers an intercept in O(log n), so that looking up new sections and
+// duplicates does not scan every tracked wave.  Adding a band finds its place
+// in O(log n) too, but then shifts the ranges after it in the vector, which
+// is O(n) in the worst case; a sorted vector is kept rather than a tree
+// because detection reads the ranges as one contiguous, sorted array (See:
+// claimed), and the ranges are few, as overlapping bands are merged.
+// The index is kept from frame to frame, reusing its storage: it is refreshed
+// from the waves once their bands have moved, and added to as waves are born.
+class BandIndex {
+  public:
+    // Replaces the contents of the index with the search bands of the waves.
+    void update(const wave_obj::WavePool& waves);
+    
+    // Adds a band to the index, merging it with the bands it overlaps.
+    void insert(const cv::Range& band);
+    
+    // Returns whether any band in the index covers the intercept.
+    bool covers(int intercept) const;
+    
+    // Empties the index.
+    void clear();
+    
+    // Returns the union of the bands in the index as sorted, disjoint ranges.
+    const std::vector<cv::Range>& claimed() const {return claimed_;}
+    
+  private:
+    // Search bands of the waves, sorted by start.
+    std::vector<cv::Range> bands_;
+    
+    // Union of the bands, as sorted, disjoint ranges.
+    std::vector<cv::Range> claimed_;
+};
 
-// Identifies when a wave no longer exists by checking its .death_ member, and
-// either destroys the object if it never became recognized, or moves it to a
-// separate vector that holds the final representations of waves that became
-// recognized in the tracking routine.
-void RemoveDeadWaves(std::vector<wave_obj::Wave>&,
-                     std::vector<wave_obj::Wave>&);
+// Storage that the tracking routine reuses from frame to frame, so that it
+// stops allocating once it has tracked the most waves it will track at once.
+// Owned by the caller, and passed to TrackWaves and RemoveDuplicateWaves.
+struct TrackingBuffers {
+    // Band sums of the current frame (See: wave_obj::BandSums).
+    wave_obj::BandSums sums;
+    
+    // Storage of the sweep of the search bands over the frame.
+    wave_obj::SweepBuffers sweep;
+    
+    // Indices of the waves from oldest to youngest, the index of the bands of
+    // the older waves, and the handles of duplicates, for removing
+    // duplicates.
+    std::vector<int> by_age;
+    BandIndex older_bands;
+    std::vector<wave_obj::WaveHandle> duplicates;
+};
 
 // Physical waves in the real world may have several different 'sections' that
 // are actually part of one wave.  This function checks to see if main() is
 // tracking separate wave objects that actually represent the same wave. If the
 // function finds this to be the case, it destroys the younger object, keeping
-// the oldest wave object for further tracking.
-void RemoveDuplicateWaves(std::vector<wave_obj::Wave>&);
+// the oldest wave object for further tracking.  Each wave is looked up in a
+// BandIndex of the bands of older waves, kept in the given buffers.  If given
+// an event queue, a death event stamped with the given frame number is pushed
+// to it for each duplicate.
+void RemoveDuplicateWaves(wave_obj::WavePool&,
+                          TrackingBuffers&,
+                          events::EventQueue* = 0,
+                          int = 0);
 
 // This function determines when a new wave object has entered the scene that
 // is not actually a wave that is already being tracked.  It takes the output
-// of the detection routine and checks each wave's data to see if it is already
-// being tracked.  If it is not, it adds the Wave object to the vector of waves
-// that are to be tracked by the TrackWaves() function above.  Waves that are
-// already being tracked are destroyed in successive calls to DetectSections().
-void AddNewSectionsToTrackedWaves(const std::vector<wave_obj::Wave>&,
-                                  std::vector<wave_obj::Wave>&);
+// of the detection routine and looks up each section's band intercept in the
+// BandIndex of the tracked waves to see if it is already being tracked.  If it
+// is not, it promotes the section to a Wave object in the pool of waves that
+// are to be tracked by the TrackWaves() function above, and adds its search
+// band to the index.  Sections of waves that are already being tracked are
+// never promoted, so they cost no Wave construction.  If given an event queue,
+// a birth event is pushed to it for each promoted section.
+void AddNewSectionsToTrackedWaves(const std::vector<wave_obj::Section>&,
+                                  wave_obj::WavePool&,
+                                  BandIndex&,
+                                  events::EventQueue* = 0);
 
 }   // namespace tracking
 
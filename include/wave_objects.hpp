@@ -4,7 +4,8 @@
 //  project:    Multiple Wave Tracking
 //
 //  contents:   Declaration of the Wave class and associated data members and
-//              member functions.  Uses OpenCV3+ library.
+//              member functions, and of the pool that holds tracked waves.
+//              Uses OpenCV3+ library.
 //
 //  use:        see readme.txt
 //
@@ -16,19 +17,340 @@
 #ifndef wave_objects_hpp
 #define wave_objects_hpp
 
+#include <type_traits>
 #include <vector>
 #include "opencv2/opencv.hpp"
 
 namespace wave_obj {
 
+// Number of frames of centroid and displacement history kept by a wave.
+const int kTrackingHistory = 20;
+
+// Fixed-capacity history of the last N values pushed, stored inline so that it
+// never allocates.  Once full, each push discards the oldest value.  Values are
+// indexed from the oldest, at 0, to the newest, at size() - 1.
+template <typename T, int N>
+class RingBuffer {
+  public:
+    RingBuffer(): values_(), begin_(0), size_(0) {}
+    
+    // Appends a value, discarding the oldest value if the buffer is full.
+    void push_back(const T& value)
+    {
+        if (size_ == N)
+        {
+            values_[begin_] = value;
+            begin_ = (begin_ + 1) % N;
+        } else {
+            values_[(begin_ + size_) % N] = value;
+            ++size_;
+        }
+    }
+    
+    const T& operator[](int i) const {return values_[(begin_ + i) % N];}
+    const T& front() const {return (*this)[0];}
+    const T& back() const {return (*this)[size_ - 1];}
+    int size() const {return size_;}
+    bool empty() const {return size_ == 0;}
+    
+  private:
+    T values_[N];
+    int begin_;
+    int size_;
+};
+
+// Section is a lightweight record of one foreground component found by the
+// detection routine (See: detection.cpp).  It owns no heap state and is
+// trivially copyable.  Most sections belong to waves that are already being
+// tracked; only those that do not are promoted to Wave objects by the tracking
+// routine (See: tracking.cpp).
+struct Section {
+    // Frame in which the section was detected.
+    int birth;
+    
+    // Spatial moments of the section.
+    double m00;
+    double m10;
+    double m01;
+    
+    // Central moments of the section.
+    double mu20;
+    double mu11;
+    double mu02;
+    
+    // Center of mass of the section in (x,y) coordinates.
+    int centroid_x;
+    int centroid_y;
+    
+    // Projection of the center of mass onto the y-axis along the wave angle.
+    int band_intercept;
+};
+
+static_assert(std::is_trivially_copyable<Section>::value,
+              "Section must remain trivially copyable");
+
+// WaveSummary is the fixed-size record that a wave leaves behind when it dies
+// (See: tracking::RemoveDeadWaves).  It holds the identity, lifetime and
+// dynamics of the wave, and a digest of its trajectory, but none of its pixel
+// state, which goes back to the pool to be reused by waves born later.
+struct WaveSummary {
+    // Name of the wave, and its frames of birth and death.
+    int name;
+    int birth;
+    int death;
+    
+    // Maximum dynamics of the wave through its existance.
+    int max_mass;
+    int max_displacement;
+    
+    // Whether or not the wave was recognized as an actual wave.
+    bool recognized;
+    
+    // Band intercept of the center of mass of the wave at birth, and the last
+    // center of mass the wave had before it died.
+    int birth_intercept;
+    int last_centroid_x;
+    int last_centroid_y;
+    
+    // Mean velocity of the wave along its direction of travel over its life,
+    // in band intercept pixels per frame.
+    double mean_velocity;
+};
+
+static_assert(std::is_trivially_copyable<WaveSummary>::value,
+              "WaveSummary must remain trivially copyable");
+
+// A horizontal run of foreground pixels [x_begin, x_end) on row y.  Waves
+// store their representation as runs, which is an order of magnitude smaller
+// than a list of pixels for wide foam lines.
+struct PixelRun {
+    int y;
+    int x_begin;
+    int x_end;
+};
+
+// Raw spatial moments of a set of pixels, up to second order, accumulated run
+// by run as pixels are found.  Integers are used so that sums are exact
+// regardless of the order they are added in.
+struct PixelMoments {
+    long long m00;
+    long long m10;
+    long long m01;
+    long long m20;
+    long long m11;
+    long long m02;
+    
+    // Adds the pixels [x_begin, x_end) of row y, in closed form.
+    void add_run(int y, int x_begin, int x_end);
+    
+    // Adds the moments of another set of pixels.
+    void add(const PixelMoments& other);
+};
+
+// Methods of computing the bounding box of a wave.  kExactBox fits a
+// minimum-area rectangle to the wave's pixels after discarding outliers, and
+// needs the wave's runs.  kMomentBox orients the box along the eigenvectors of
+// the wave's pixel covariance with extents of three standard deviations, and
+// is computed in constant time from the wave's moments.
+enum BoxMode {
+    kExactBox,
+    kMomentBox
+};
+
+// Projects the point (x,y) onto the y-axis along the angle of the wave axis.
+// Waves travel orthogonal to this axis, so the projection (the "band
+// intercept") locates a point in the one dimension of wave travel.
+int BandIntercept(int x, int y);
+
+// Returns the columns of row y, clipped to [0, width), whose band intercepts
+// fall in the range of intercepts band.  Band intercepts grow with x along a
+// row, so these columns are always contiguous.
+cv::Range BandRowSpan(int y, const cv::Range& band, int width);
+
+// Moments of the foreground of a frame, summed over each band intercept (See:
+// BandIntercept) and then prefix-summed over intercepts.  Every search band
+// shares the slant of the wave axis, so in intercept space a band is a plain
+// range, and the moments of the foreground inside any band come out of two
+// lookups.  Building the sums reads the whole frame once; each band after
+// that costs constant time regardless of its size.
+class BandSums {
+  public:
+    BandSums(): prefix_(), segment_begin_(), stripe_bins_(), width_(-1) {}
+    
+    // Sums the moments of the foreground of the frame over band intercepts.
+    void build(const cv::Mat& frame);
+    
+    // Returns the moments of the foreground inside the band of intercepts.
+    PixelMoments band_moments(const cv::Range& band) const;
+    
+  private:
+    // Moments of all foreground with band intercept below each index.
+    std::vector<PixelMoments> prefix_;
+    
+    // First column of each offset of band intercept from the start of a row,
+    // plus the width of the frame.
+    std::vector<int> segment_begin_;
+    
+    // Bins of each horizontal stripe of a large frame, binned in parallel.
+    std::vector<std::vector<PixelMoments> > stripe_bins_;
+    
+    // Width of the frame the sums were last built for.
+    int width_;
+};
+
+// The search band of one wave as it is swept down the frame (See:
+// UpdateAllPoints), with the rows that its intercepts can fall in.
+struct BandSweep {
+    cv::Range band;
+    int row_begin;
+    int row_end;
+    int wave;
+};
+
+// A horizontal stripe of the frame swept by its own thread, with the outputs
+// it accumulates the waves' pixels into and the buffers of its sweep.
+struct SweepStripe {
+    int row_begin;
+    int row_end;
+    
+    // Storage of the stripe's own moments and runs, by wave.
+    std::vector<PixelMoments> moments;
+    std::vector<std::vector<PixelRun> > runs;
+    
+    // Where the stripe accumulates each wave's moments and runs.
+    std::vector<PixelMoments*> moments_out;
+    std::vector<std::vector<PixelRun>*> runs_out;
+    
+    // Bands active on the current row, their spans of columns on the row, and
+    // the runs of foreground of the row inside the union of the spans.
+    std::vector<BandSweep> active;
+    std::vector<cv::Range> spans;
+    std::vector<PixelRun> row_runs;
+};
+
+// Storage that UpdateAllPoints reuses from frame to frame, so that it stops
+// allocating once it has swept the most waves it will track at once.  Owned
+// by the caller (See: tracking::TrackingBuffers).
+struct SweepBuffers {
+    // Search bands of the waves, sorted by start.
+    std::vector<BandSweep> sweeps;
+    
+    // Horizontal stripes of the frame.
+    std::vector<SweepStripe> stripes;
+};
+
+class Wave;
+class WavePool;
+
+// WaveTable holds the kinematic state of the live waves of a pool as a
+// structure of parallel arrays, with one row per live wave, in the order of
+// the pool's live waves (See: WavePool).  The table is the only copy of this
+// state: each wave reads its own row through the index it keeps, the search
+// band sweep accumulates moments straight into the rows (See:
+// UpdateAllPoints), and the pool moves the last row into the place of a
+// destroyed wave's row, as it does with the wave itself.  The per-frame
+// updates of death, centroid, displacement, mass and recognition then run for
+// every wave at once, in tight loops over contiguous arrays, rather than as a
+// chain of member function calls on each Wave.
+class WaveTable {
+    friend class Wave;
+    friend class WavePool;
+    friend void UpdateAllPoints(WavePool& waves, const cv::Mat& frame,
+                                SweepBuffers& buffers, bool keep_runs);
+    
+  public:
+    WaveTable(): moments_(), axis_a_(), axis_b_(), axis_c_(), centroid_x_(),
+                 centroid_y_(), centroid_history_(), displacement_(),
+                 max_displacement_(), displacement_history_(), mass_(),
+                 max_mass_(), death_(), recognized_(), recognized_rows_() {}
+    
+    // Updates the kinematic state of every wave in the table from the moments
+    // of its representation in the given frame.  If kill_all is set (the last
+    // frame), every wave dies.
+    //   Death: a wave dies in the frame in which it has no pixels.
+    //   Centroid: the center-of-mass of the wave, from first-order moments, or
+    //     (-1,-1) if the wave has no pixels.  Appended to the history of
+    //     centroids for temporal tracking.
+    //   Displacement: one of two wave dynamics used to determine if the wave
+    //     is a positive instance of a wave.  This measures the distance in
+    //     pixels of the centroid orthogonal to the wave's original major axis.
+    //     A wave with no centroid keeps its last displacement.  Appended to
+    //     the history of displacements.
+    //   Mass: the other wave dynamic, measuring the number of pixels in the
+    //     representation of the wave.
+    //   Recognition: a wave becomes recognized, for good, once both its
+    //     maximum displacement and maximum mass meet user-defined thresholds.
+    void update(int frame_number, bool kill_all);
+    
+    // Rows of the waves that became recognized in the last update.
+    const std::vector<int>& recognized_rows() const {return recognized_rows_;}
+    
+    // Number of rows, one for each live wave of the pool.
+    int size() const {return static_cast<int>(mass_.size());}
+    
+  private:
+    // Moments of the pixels of the representation of each wave.
+    std::vector<PixelMoments> moments_;
+    
+    // Equation of each wave's original axis in standard form, Ax + By = C,
+    // through its center of mass at birth.
+    std::vector<double> axis_a_;
+    std::vector<double> axis_b_;
+    std::vector<double> axis_c_;
+    
+    // Center of mass of each wave in (x,y) coordinates, and its history.
+    std::vector<int> centroid_x_;
+    std::vector<int> centroid_y_;
+    std::vector<RingBuffer<cv::Point, kTrackingHistory> > centroid_history_;
+    
+    // Instantaneous and maximum displacement of each wave relative to its
+    // original axis, and the history of its displacements.
+    std::vector<int> displacement_;
+    std::vector<int> max_displacement_;
+    std::vector<RingBuffer<int, kTrackingHistory> > displacement_history_;
+    
+    // Instantaneous and maximum mass of each wave.
+    std::vector<int> mass_;
+    std::vector<int> max_mass_;
+    
+    // Frame of death of each wave (-1 if still alive), and whether it is
+    // recognized as an actual wave.
+    std::vector<int> death_;
+    std::vector<unsigned char> recognized_;
+    
+    // Rows that became recognized in the last update.
+    std::vector<int> recognized_rows_;
+    
+    // Appends a row for a wave born from a section, and returns it.
+    int append(const Section& section);
+    
+    // Removes a row, moving the last row into its place.
+    void remove(int row);
+};
+
 // Wave object is initiated with the following data members and contruction
 // methods.  Waves are meant to be tracked through frames (See: tracking.cpp)
 // and all methods prepended with 'update' are intended to be called in
-// successive frames.  Methods prepended with 'set' are meant to be called
-// during construction only.
+// successive frames, along with the kinematic update of the table of the
+// wave's pool (See: WaveTable).  Methods prepended with 'set' are meant to be
+// called during construction only.
 class Wave {
+    friend class WavePool;
+    friend void UpdateAllPoints(WavePool& waves, const cv::Mat& frame,
+                                SweepBuffers& buffers, bool keep_runs);
+    
   public:
-    Wave(std::vector<cv::Point> contour, int frame_number);
+    // Constructs a wave from a section, whose kinematic state is held in the
+    // given row of a table.  Waves are constructed by a pool (See:
+    // WavePool::create), which adds the row to its table first.
+    Wave(const Section& section, WaveTable* table, int row);
+    
+    // Waves are moved, never copied, from birth to death, so that the heap
+    // state allocated at birth is never duplicated.
+    Wave(const Wave&) = delete;
+    Wave& operator=(const Wave&) = delete;
+    Wave(Wave&&) = default;
+    Wave& operator=(Wave&&) = default;
     
     // ---  DATA MEMBERS ---
     
@@ -41,102 +363,202 @@ class Wave {
     // Ex-ante angle of major axis of wave.
     double axis_angle_;
     
-    // Center of mass of the wave in (x,y) coordinates.
-    cv::Point centroid_;
+    // Coordinates of polygon bounding a search ROI, in the order upper-left,
+    // upper-right, lower-right, lower-left.
+    cv::Point searchroi_coors_[4];
     
-    // Deque of centroids.
-    std::deque<cv::Point> centroid_vec_;
+    // Estimated velocity of the wave along its direction of travel, in band
+    // intercept pixels per frame.
+    double velocity_;
     
-    // Coordinates of polygon bounding a search ROI.
-    std::vector<std::vector<cv::Point> > searchroi_coors_;
+    // Half-width of the search band, in band intercept pixels.
+    int search_buffer_;
     
-    // Equation of the wave's original axis in standard form.
-    double original_axis_[3];
     
-    // Coordinates of polygon bounding the wave points.
-    cv::Mat boundingbox_coors_;
+    // --- KINEMATICS ---
     
-    // Instantaneous displacement of wave relative to its origin.
-    int displacement_;
+    // The kinematic state of the wave, read from its row of the table (See:
+    // WaveTable::update).
     
-    // Maximum displacement of the wave through its existance.
-    int max_displacement_;
+    // Center of mass of the wave in (x,y) coordinates, and its history.
+    cv::Point centroid() const
+    {
+        return cv::Point(table_->centroid_x_[row_], table_->centroid_y_[row_]);
+    }
+    const RingBuffer<cv::Point, kTrackingHistory>& centroid_history() const
+    {
+        return table_->centroid_history_[row_];
+    }
     
-    // Deque of displacements of the wave over time.
-    std::deque<int> displacement_vec_;
+    // Instantaneous and maximum displacement of the wave relative to its
+    // original axis.
+    int displacement() const {return table_->displacement_[row_];}
+    int max_displacement() const {return table_->max_displacement_[row_];}
     
-    // Instantaneous mass of wave.
-    int mass_;
-    
-    // Maximum mass of wave through its existance.
-    int max_mass_;
+    // Instantaneous and maximum mass of the wave.
+    int mass() const {return table_->mass_[row_];}
+    int max_mass() const {return table_->max_mass_[row_];}
     
     // Whether or not the wave is recognized as an actual wave.
-    bool recognized_;
+    bool recognized() const {return table_->recognized_[row_] != 0;}
     
-    // Frame of Death of the wave (-1 if still alive).
-    int death_;
+    // Frame of death of the wave (-1 if still alive).
+    int death() const {return table_->death_[row_];}
     
     
     // --- WAVE METHODS ---
     
+    // Fits a constant velocity to the band intercepts of the recent centroid
+    // history, and sets the half-width of the next search band to cover the
+    // spread of the wave's pixels plus the uncertainty of the prediction,
+    // within user-defined bounds.  Until there is enough history, the band
+    // keeps its widest setting, kSearchRegionBuffer.
+    void update_prediction();
+    
     // Updates the search region of interest in which a wave will identify its
     // representation in successive frames by using its current center-of-mass
-    // estimate and a user-defined constant kSearchRegionBuffer.
+    // estimate advanced by its velocity, and its search buffer.
     void update_searchroi_coors();
     
-    // Determines if a wave has disappeared from a video, in which case we would
-    // no longer want to track it.
-    void update_death(int frame_number);
+    // Returns the band of intercepts (See: BandIntercept) covered by the
+    // search ROI, as the range between its upper-left and lower-left corners.
+    cv::Range search_band() const;
+    
+    // Updates the moments of the representation of the wave in constant time
+    // from the band sums of the current frame, instead of scanning the frame.
+    // No runs are found, so exact bounding boxes are not available.
+    void update_moments(const BandSums& sums);
     
-    // The main representation of a wave is in the points_ attribute. This
-    // function updates the points_ in current frame by masking the frame
-    // according to the searchroi_coors_ attribute and measuring the result.
-    void update_points(const cv::Mat& frame);
+    // Reduces the wave to the summary that is kept once it dies.
+    WaveSummary summarize() const;
     
-    // Centroid represents the center-of-mass of the wave's representation.
-    // Updates this attribute by calculating the center-of-mass using
-    // first-order moments. Updates the deque of centroids for temporal tracking
-    // as well.  Centroid is used to calculate displacement of the wave.
-    void update_centroid();
+    // --- DISPLAY GEOMETRY ---
     
     // Bounding Box Coordinates bound the representation of the wave in a
-    // quadrangle shape.  This is solely for display purposes if the user is
+    // quadrangle shape, as an array of four corners (or null if the wave has
+    // no box yet).  This is solely for display purposes if the user is
     // outputing a video with wave detection/tracking overlaid on the source
-    // video.
-    void update_boundingbox_coors();
+    // video, so it is computed lazily by the given method (See: BoxMode) the
+    // first time it is asked for in a frame, and never in headless runs.  The
+    // exact method needs the wave's runs to have been kept by
+    // UpdateAllPoints(); otherwise the last box is returned.
+    const cv::Point2f* boundingbox_coors(BoxMode mode = kExactBox);
     
-    // Displacement is one of two wave dynamics used to determine if the wave is
-    // a positive instance of a wave.  This measures the distance in pixels of
-    // the displacement of the wave orthogonal to its original major axis.
-    // Updates max_displacement_ and the deque of displacements accordingly.
-    void update_displacement();
+  private:
+
+    // Representation of the wave as runs of pixels, in raster order.
+    std::vector<PixelRun> runs_;
     
-    // Mass is one of two wave dynamics used to determine if the wave is a
-    // positive instance of a wave.  This measures the mass of the
-    // representation of the wave in pixels.  Updates max_mass accordingly.
-    void update_mass();
+    // Table that holds the kinematic state of the wave, and the row of the
+    // wave in it.
+    WaveTable* table_;
+    int row_;
     
-    // Evaluates the two wave dynamics of mass and displacement if and only if
-    // the wave is not already recognized.  This determines whether or not a
-    // wave is actually a wave by user definition.
-    void update_recognized();
+    // Coordinates of polygon bounding the wave points, computed on demand.
+    cv::Point2f boundingbox_coors_[4];
     
-  private:
-
-    // Representation of the wave.
-    std::vector<cv::Point> points_;
+    // Whether boundingbox_coors_ has been computed, whether it is out of date
+    // with the representation, and the method it was last computed by.
+    bool has_boundingbox_;
+    bool boundingbox_stale_;
+    BoxMode boundingbox_mode_;
+    
+    // Reinitializes the wave from a section as a newly constructed wave in
+    // the given row of a table, keeping the storage of its runs for reuse.
+    void reset(const Section& section, WaveTable* table, int row);
+    
+    // Computes boundingbox_coors_ from the representation of the wave.
+    void compute_boundingbox_coors(BoxMode mode);
     
     // Sets the name of the wave using an integer.
     void set_wave_name();
+};
+
+// Stable reference to a wave in a WavePool: the slot that holds the wave and
+// the generation of the slot when the wave was born.  A handle stays valid for
+// the life of its wave, wherever the live waves are stored, and goes stale
+// once the wave is destroyed, even if its slot holds a newer wave.
+struct WaveHandle {
+    int slot;
+    unsigned int generation;
+};
+
+// Storage for the waves being tracked.  Waves are held in slots that are
+// recycled through a free list, so that a wave born into a recycled slot
+// reuses the heap storage of the wave that died in it, and memory stops
+// growing once the pool has as many slots as the most waves ever tracked at
+// once.  Live waves are indexed 0..size()-1 in no particular order, and
+// destroying a wave is constant time.  Indices change as waves are destroyed;
+// handles do not.
+class WavePool {
+  public:
+    WavePool(): slots_(), generations_(), free_slots_(), live_(),
+                live_position_(), table_() {}
+    
+    // Waves hold a pointer to the table of their pool, so pools are never
+    // copied.
+    WavePool(const WavePool&) = delete;
+    WavePool& operator=(const WavePool&) = delete;
     
-    // Sets the standard line equation for the wave's original axis.  Standard
-    // form of a line is denoted as Ax + By = C.  This is used to determine
-    // orthogonal displacement of the wave overtime through the
-    // update_displacement() function below.
-    void set_original_axis();
+    // Constructs a wave from a section in a free slot, and returns its handle.
+    WaveHandle create(const Section& section);
+    
+    // Destroys the wave of a handle, returning its slot to the free list.
+    // Stale handles are ignored.
+    void destroy(WaveHandle handle);
+    
+    // Returns the wave of a handle, or null if the handle is stale.
+    Wave* get(WaveHandle handle);
+    const Wave* get(WaveHandle handle) const;
+    
+    // Live waves, and their handles, by index.
+    Wave& operator[](int i) {return slots_[live_[i]];}
+    const Wave& operator[](int i) const {return slots_[live_[i]];}
+    WaveHandle handle(int i) const;
+    
+    // Number of live waves, and of slots.
+    int size() const {return static_cast<int>(live_.size());}
+    bool empty() const {return live_.empty();}
+    int capacity() const {return static_cast<int>(slots_.size());}
+    
+    // Kinematic state of the live waves, by index.
+    WaveTable& table() {return table_;}
+    const WaveTable& table() const {return table_;}
+    
+  private:
+    // Every wave ever constructed by the pool, live or not, by slot.
+    std::vector<Wave> slots_;
+    
+    // Generation of each slot, incremented when its wave is destroyed.
+    std::vector<unsigned int> generations_;
+    
+    // Slots whose waves have been destroyed, ready for reuse.
+    std::vector<int> free_slots_;
+    
+    // Slots of the live waves, and the index of each slot in live_ (or -1).
+    std::vector<int> live_;
+    std::vector<int> live_position_;
+    
+    // Kinematic state of the live waves, with the row of each at its index in
+    // live_.
+    WaveTable table_;
 };
 
+// Updates the representation of every wave in a pool in a single raster pass
+// over the frame.  The representation of a wave is its runs of foreground
+// pixels inside its search band, and their moments, which are accumulated
+// straight into the wave's row of the pool's table and are all that the
+// kinematic update needs (See: WaveTable::update); runs are only kept if
+// keep_runs is set, for the bounding box.  Each row's span of columns inside
+// a band is computed from the band geometry (See: BandRowSpan).  The search
+// bands of the waves are swept down the frame in order, so each row is read
+// once over the union of the bands that cover it, and its runs of foreground
+// are then split among those bands.  The cost is proportional to the area of the
+// union of the bands plus their overlaps, rather than to the sum of the band
+// areas.  Scratch storage is kept in buffers from call to call.
+void UpdateAllPoints(WavePool& waves, const cv::Mat& frame,
+                     SweepBuffers& buffers, bool keep_runs = false);
+
 }   // namespace wave_obj
 
 #endif /* wave_objects_hpp */
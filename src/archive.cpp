@@ -0,0 +1,464 @@
+//
+//  file:       archive.cpp
+//
+//  project:    Multiple Wave Tracking
+//
+//  contents:   Definitions of the wave archive writer and reader.  Associated
+//              header file is archive.hpp.
+//
+//  use:        see readme.txt
+//
+
+#include "archive.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iostream>
+#include <limits>
+
+
+// ---INTERNAL LINKAGE---
+namespace {
+
+// Archive format constants.
+const char kArchiveMagic[8] = {'M', 'W', 'T', 'A', 'R', 'C', 'H', '\n'};
+const uint32_t kArchiveVersion = 2;
+const size_t kHeaderSize = sizeof(kArchiveMagic) + sizeof(uint32_t);
+const size_t kRecordOverhead = 2*sizeof(uint32_t);
+
+// Length of an encoded summary: eight 32-bit integers, one byte for the
+// recognized flag and the 64 bits of the mean velocity (See: EncodeSummary).
+const size_t kSummarySize = 8*sizeof(uint32_t) + 1 + sizeof(uint64_t);
+
+static_assert(std::numeric_limits<double>::is_iec559 && sizeof(double) == 8,
+              "Mean velocities are archived as IEEE 754 doubles");
+
+// Longest time a summary waits in memory before it is written and synced.
+const std::chrono::milliseconds kSyncInterval(1000);
+
+// Args:
+//   data: pointer to bytes
+//   length: number of bytes
+// Operation:
+//   Returns the 32-bit FNV-1a hash of the bytes.
+uint32_t Checksum(const unsigned char* data, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i != length; ++i)
+    {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Args:
+//   out: pointer to 4 bytes
+//   value: an unsigned 32-bit integer
+// Operation:
+//   Writes the value to the bytes, least significant byte first.
+void PutUint32(unsigned char* out, uint32_t value)
+{
+    for (int i = 0; i != 4; ++i)
+        out[i] = static_cast<unsigned char>(value >> 8*i);
+}
+
+// Args:
+//   in: pointer to 4 bytes written by PutUint32
+// Operation:
+//   Returns the unsigned 32-bit integer in the bytes.
+uint32_t GetUint32(const unsigned char* in)
+{
+    uint32_t value = 0;
+    for (int i = 0; i != 4; ++i)
+        value |= static_cast<uint32_t>(in[i]) << 8*i;
+    return value;
+}
+
+// Args:
+//   out: pointer to 8 bytes
+//   value: an unsigned 64-bit integer
+// Operation:
+//   Writes the value to the bytes, least significant byte first.
+void PutUint64(unsigned char* out, uint64_t value)
+{
+    for (int i = 0; i != 8; ++i)
+        out[i] = static_cast<unsigned char>(value >> 8*i);
+}
+
+// Args:
+//   in: pointer to 8 bytes written by PutUint64
+// Operation:
+//   Returns the unsigned 64-bit integer in the bytes.
+uint64_t GetUint64(const unsigned char* in)
+{
+    uint64_t value = 0;
+    for (int i = 0; i != 8; ++i)
+        value |= static_cast<uint64_t>(in[i]) << 8*i;
+    return value;
+}
+
+// Args:
+//   summary: summary of a recognized wave
+//   out: pointer to kSummarySize bytes
+// Operation:
+//   Encodes the fields of the summary in order of declaration, each in a
+//   fixed width and little-endian, so that the encoding does not depend on
+//   the compiler's layout of WaveSummary or on the byte order of the host.
+//   Returns a pointer past the last byte written.
+unsigned char* EncodeSummary(const wave_obj::WaveSummary& summary,
+                             unsigned char* out)
+{
+    PutUint32(out, static_cast<uint32_t>(summary.name));
+    PutUint32(out + 4, static_cast<uint32_t>(summary.birth));
+    PutUint32(out + 8, static_cast<uint32_t>(summary.death));
+    PutUint32(out + 12, static_cast<uint32_t>(summary.max_mass));
+    PutUint32(out + 16, static_cast<uint32_t>(summary.max_displacement));
+    out[20] = summary.recognized ? 1 : 0;
+    PutUint32(out + 21, static_cast<uint32_t>(summary.birth_intercept));
+    PutUint32(out + 25, static_cast<uint32_t>(summary.last_centroid_x));
+    PutUint32(out + 29, static_cast<uint32_t>(summary.last_centroid_y));
+
+    uint64_t velocity_bits;
+    memcpy(&velocity_bits, &summary.mean_velocity, sizeof(velocity_bits));
+    PutUint64(out + 33, velocity_bits);
+    return out + kSummarySize;
+}
+
+// Args:
+//   in: pointer to kSummarySize bytes written by EncodeSummary
+// Operation:
+//   Decodes a summary from the bytes.
+wave_obj::WaveSummary DecodeSummary(const unsigned char* in)
+{
+    wave_obj::WaveSummary summary;
+    summary.name = static_cast<int32_t>(GetUint32(in));
+    summary.birth = static_cast<int32_t>(GetUint32(in + 4));
+    summary.death = static_cast<int32_t>(GetUint32(in + 8));
+    summary.max_mass = static_cast<int32_t>(GetUint32(in + 12));
+    summary.max_displacement = static_cast<int32_t>(GetUint32(in + 16));
+    summary.recognized = in[20] != 0;
+    summary.birth_intercept = static_cast<int32_t>(GetUint32(in + 21));
+    summary.last_centroid_x = static_cast<int32_t>(GetUint32(in + 25));
+    summary.last_centroid_y = static_cast<int32_t>(GetUint32(in + 29));
+
+    uint64_t velocity_bits = GetUint64(in + 33);
+    memcpy(&summary.mean_velocity, &velocity_bits, sizeof(velocity_bits));
+    return summary;
+}
+
+// Args:
+//   data: pointer to the bytes of an archive
+//   length: length of the archive in bytes
+//   offsets: a pointer to a vector for the payload offsets, or null
+// Operation:
+//   Checks the header of an archive and walks its records, appending the
+//   offset of each intact record's payload to offsets.  Returns the length of
+//   the intact part of the archive, or 0 if the header is not valid.
+size_t LocateRecords(const unsigned char* data, size_t length,
+                     std::vector<size_t>* offsets)
+{
+    if (length < kHeaderSize ||
+        memcmp(data, kArchiveMagic, sizeof(kArchiveMagic)) != 0 ||
+        GetUint32(data + sizeof(kArchiveMagic)) != kArchiveVersion)
+        return 0;
+
+    size_t offset = kHeaderSize;
+    while (length - offset >= kRecordOverhead)
+    {
+        uint32_t payload_length = GetUint32(data + offset);
+        if (payload_length != kSummarySize ||
+            length - offset - kRecordOverhead < payload_length)
+            break;
+
+        const unsigned char* payload = data + offset + sizeof(uint32_t);
+        if (GetUint32(payload + payload_length) !=
+            Checksum(payload, payload_length))
+            break;
+
+        if (offsets != 0)
+            offsets->push_back(offset + sizeof(uint32_t));
+        offset += kRecordOverhead + payload_length;
+    }
+    return offset;
+}
+
+// Args:
+//   fd: a file descriptor open for writing
+//   data: pointer to bytes
+//   length: number of bytes
+// Operation:
+//   Writes all of the bytes, retrying partial and interrupted writes.  Returns
+//   false on error.
+bool WriteAll(int fd, const unsigned char* data, size_t length)
+{
+    while (length != 0)
+    {
+        ssize_t written = ::write(fd, data, length);
+        if (written < 0)
+        {
+            if (errno == EINTR) {continue;}
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+// Args:
+//   fd: a file descriptor open for reading and writing
+//   length_out: a reference to the length of the prepared archive
+// Operation:
+//   Prepares an archive for appending: writes the header to an empty file, or
+//   checks the header of an existing one and truncates any torn record at its
+//   end.  Returns false if the file is not an archive.
+bool PrepareForAppend(int fd, off_t& length_out)
+{
+    struct stat status;
+    if (fstat(fd, &status) != 0)
+        return false;
+
+    if (status.st_size == 0)
+    {
+        unsigned char header[kHeaderSize];
+        memcpy(header, kArchiveMagic, sizeof(kArchiveMagic));
+        PutUint32(header + sizeof(kArchiveMagic), kArchiveVersion);
+        length_out = kHeaderSize;
+        return WriteAll(fd, header, kHeaderSize) && fsync(fd) == 0;
+    }
+
+    size_t length = static_cast<size_t>(status.st_size);
+    void* map = mmap(0, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return false;
+    size_t intact = LocateRecords(static_cast<const unsigned char*>(map),
+                                  length, 0);
+    munmap(map, length);
+
+    if (intact == 0)
+        return false;
+    length_out = static_cast<off_t>(intact);
+    if (intact != length)
+        return ftruncate(fd, intact) == 0 && fsync(fd) == 0;
+    return true;
+}
+
+}   // namespace
+
+
+// ---EXTERNAL LINKAGE---
+namespace archive {
+
+//---ARCHIVE WRITER---
+
+// Opens an archive for appending on a background thread.
+//
+// Args:
+//   path: path of the archive file
+// Example:
+//   archive::ArchiveWriter writer("waves.mwta");
+//   if (writer.is_open()) {writer.append(summary);}
+ArchiveWriter::ArchiveWriter(const std::string& path):
+    fd_(-1),
+    pending_(),
+    appended_(0),
+    synced_(0),
+    synced_length_(0),
+    failed_(false),
+    flush_requested_(false),
+    stopping_(false)
+{
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd == -1)
+        return;
+    if (!PrepareForAppend(fd, synced_length_))
+    {
+        ::close(fd);
+        return;
+    }
+    fd_ = fd;
+    thread_ = std::thread(&ArchiveWriter::run, this);
+}
+
+// Operation:
+//   Stops the writing thread once it has written and synced every pending
+//   summary, and closes the archive.
+ArchiveWriter::~ArchiveWriter()
+{
+    if (fd_ == -1) {return;}
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+    ::close(fd_);
+}
+
+// Args:
+//   summary: summary of a recognized wave
+// Operation:
+//   Queues the summary for the writing thread, and wakes it.
+void ArchiveWriter::append(const wave_obj::WaveSummary& summary)
+{
+    if (fd_ == -1) {return;}
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(summary);
+        ++appended_;
+    }
+    wake_.notify_one();
+}
+
+// Operation:
+//   Asks the writing thread to write without waiting for its batch to fill,
+//   then waits until every summary appended so far is synced, or until the
+//   write fails.  Returns the number of summaries still pending.
+long long ArchiveWriter::flush()
+{
+    if (fd_ == -1) {return 0;}
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    long long target = appended_;
+    if (synced_ < target)
+    {
+        // The writing thread clears the request when it takes a batch, so a
+        // failure with the request cleared is of a write made for it.
+        flush_requested_ = true;
+        wake_.notify_one();
+        synced_cond_.wait(lock, [this, target] {
+            return synced_ >= target || (failed_ && !flush_requested_);
+        });
+    }
+    return appended_ - synced_;
+}
+
+// Operation:
+//   Waits for summaries, then gives later summaries up to kSyncInterval to
+//   join them in a batch.  Each batch is written with a single write and made
+//   durable with a single fsync.  The batch buffers are reused, so memory
+//   does not grow with the number of summaries written.  A batch that fails
+//   to be written is cut from the end of the archive and put back ahead of
+//   the pending summaries, to be retried with them, except when stopping.
+void ArchiveWriter::run()
+{
+    std::vector<wave_obj::WaveSummary> batch;
+    std::vector<unsigned char> bytes;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+        wake_.wait(lock, [this] {return stopping_ || !pending_.empty();});
+        if (!stopping_)
+            wake_.wait_for(lock, kSyncInterval,
+                           [this] {return stopping_ || flush_requested_;});
+
+        if (pending_.empty() && stopping_) {break;}
+
+        batch.swap(pending_);
+        flush_requested_ = false;
+        lock.unlock();
+
+        // Serialize the batch as records.
+        bytes.resize(batch.size()*(kRecordOverhead + kSummarySize));
+        unsigned char* out = bytes.data();
+        for (std::vector<wave_obj::WaveSummary>::size_type i = 0;
+             i != batch.size(); ++i)
+        {
+            unsigned char* payload = out + sizeof(uint32_t);
+            unsigned char* end = EncodeSummary(batch[i], payload);
+            uint32_t payload_length = static_cast<uint32_t>(end - payload);
+            PutUint32(out, payload_length);
+            PutUint32(end, Checksum(payload, payload_length));
+            out = end + sizeof(uint32_t);
+        }
+
+        bool written = WriteAll(fd_, bytes.data(), bytes.size()) &&
+                       fsync(fd_) == 0;
+        int error = written ? 0 : errno;
+        if (!written && ftruncate(fd_, synced_length_) != 0)
+            error = errno;
+
+        lock.lock();
+        if (written)
+        {
+            synced_ += batch.size();
+            synced_length_ += static_cast<off_t>(bytes.size());
+            batch.clear();
+        } else {
+            if (!failed_)
+                std::cerr << "Error writing the wave archive: "
+                          << strerror(error) << "; " << appended_ - synced_
+                          << " wave(s) pending, retrying." << std::endl;
+            batch.insert(batch.end(), pending_.begin(), pending_.end());
+            batch.swap(pending_);
+            batch.clear();
+        }
+        failed_ = !written;
+        synced_cond_.notify_all();
+        if (!written && stopping_) {break;}
+    }
+}
+
+
+//---ARCHIVE READER---
+
+// Maps an archive for reading.
+//
+// Args:
+//   path: path of the archive file
+// Example:
+//   archive::ArchiveReader reader("waves.mwta");
+//   for (int i = 0; i != reader.size(); ++i) {reader.at(i).name;}
+ArchiveReader::ArchiveReader(const std::string& path):
+    data_(0),
+    length_(0),
+    is_open_(false),
+    offsets_()
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return;
+
+    struct stat status;
+    if (fstat(fd, &status) == 0 && status.st_size > 0)
+    {
+        length_ = static_cast<size_t>(status.st_size);
+        void* map = mmap(0, length_, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED)
+            data_ = static_cast<const unsigned char*>(map);
+    }
+    ::close(fd);
+
+    if (data_ != 0)
+        is_open_ = LocateRecords(data_, length_, &offsets_) != 0;
+}
+
+// Operation:
+//   Unmaps the archive.
+ArchiveReader::~ArchiveReader()
+{
+    if (data_ != 0)
+        munmap(const_cast<unsigned char*>(data_), length_);
+}
+
+// Args:
+//   i: index of a record, in order of writing
+// Operation:
+//   Decodes the summary from the mapping.
+wave_obj::WaveSummary ArchiveReader::at(int i) const
+{
+    return DecodeSummary(data_ + offsets_[i]);
+}
+
+}   // namespace archive
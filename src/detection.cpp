@@ -4,8 +4,8 @@
 //  project:    Multiple Wave Tracking
 //
 //  contents:   Defintions of the Wave detection functions.  Associated header
-//              file is detection.hpp.  Detection routine search for contours,
-//              filters contours, and returns Wave objects.
+//              file is detection.hpp.  Detection routine labels connected
+//              foreground components, filters them, and returns Section records.
 //
 //  use:        see readme.txt
 //
@@ -16,39 +16,500 @@
 
 #include "detection.hpp"
 
+#include "preprocessing.hpp"
+
 
 // ---INTERNAL LINKAGE---
 namespace {
 
-// Minimum area threshold for contour detection.
+// Minimum area threshold for section detection.
 const int kMinArea = 100;
 
-// Inertia thresholds for contour detection.
+// Inertia thresholds for section detection.
 const double kMinInertiaRatio = 0.0;
 const double kMaxInertiaRatio = 0.1;
 
+// Minimum number of rows in a parallel tile.
+const int kMinTileRows = 32;
+
+// Untracked foreground area that triggers detection ahead of its cadence.
+const int kDetectionTriggerArea = 400;
+
+// A horizontal run of foreground pixels [x_begin, x_end) on row y.  Parent is
+// the index of the run's parent in the union-find forest of runs, and is equal
+// to the run's own index for the root of a component.  Tracked is set if the
+// run touches foreground inside a claimed band.
+struct Run {
+    int y;
+    int x_begin;
+    int x_end;
+    int parent;
+    bool tracked;
+};
+
+// Args:
+//   runs: a reference to a vector of runs
+//   i: index of a run
+// Operation:
+//   Returns the index of the root of the component containing run i,
+//   compressing the path to the root along the way.
+int FindRoot(std::vector<Run>& runs, int i)
+{
+    int root = i;
+    while (runs[root].parent != root)
+        root = runs[root].parent;
+    
+    while (runs[i].parent != root)
+    {
+        int next = runs[i].parent;
+        runs[i].parent = root;
+        i = next;
+    }
+    return root;
+}
+
+// Args:
+//   runs: a reference to a vector of runs
+//   sums: a reference to the moment sums of each run
+//   a: index of a run
+//   b: index of a different run
+// Operation:
+//   Joins the components of runs a and b.  The root with the lower index (the
+//   run found first in raster order) becomes the root of the joined component
+//   and takes on the moment sums of the other.
+void UnionRuns(std::vector<Run>& runs, std::vector<wave_obj::PixelMoments>& sums,
+               int a, int b)
+{
+    int root_a = FindRoot(runs, a);
+    int root_b = FindRoot(runs, b);
+    if (root_a == root_b)
+        return;
+    
+    if (root_b < root_a)
+        std::swap(root_a, root_b);
+    
+    runs[root_b].parent = root_a;
+    sums[root_a].add(sums[root_b]);
+}
+
+// Args:
+//   runs: a reference to a vector of runs
+//   sums: a reference to the moment sums of each run
+//   prev_begin, prev_end: index range of the runs of one row
+//   cur_begin, cur_end: index range of the runs of the row below it
+// Operation:
+//   Joins every run of the lower row to the runs of the upper row that touch
+//   it, including diagonally.  Both ranges are in increasing x order.
+void JoinRows(std::vector<Run>& runs, std::vector<wave_obj::PixelMoments>& sums,
+              int prev_begin, int prev_end, int cur_begin, int cur_end)
+{
+    int j = prev_begin;
+    
+    for (int i = cur_begin; i != cur_end; ++i)
+    {
+        while (j != prev_end && runs[j].x_end < runs[i].x_begin) {++j;}
+        for (int k = j; k != prev_end && runs[k].x_begin <= runs[i].x_end; ++k)
+            UnionRuns(runs, sums, k, i);
+    }
+}
+
+// Args:
+//   intercept: a band intercept
+//   range: const ref to a range
+// Operation:
+//   Comparison function for searching sorted ranges for the first range that
+//   starts after an intercept.
+bool RangeStartsAfter(int intercept, const cv::Range& range)
+{
+    return intercept < range.start;
+}
+
+// Args:
+//   intercept: a band intercept
+//   claimed_bands: a const reference to sorted, disjoint claimed bands
+// Operation:
+//   Returns true if a claimed band covers the intercept.
+bool InClaimedBand(int intercept, const std::vector<cv::Range>& claimed_bands)
+{
+    std::vector<cv::Range>::const_iterator after =
+            std::upper_bound(claimed_bands.begin(), claimed_bands.end(),
+                             intercept, RangeStartsAfter);
+    return after != claimed_bands.begin() && (after - 1)->end > intercept;
+}
+
+// Args:
+//   y: a row of the binary image
+//   width: width of the binary image
+//   claimed_bands: a const reference to sorted, disjoint claimed bands
+//   spans: a reference to a vector of column ranges
+// Operation:
+//   Replaces spans with the non-empty column ranges of row y, in increasing x
+//   order, that lie inside a claimed band.
+void ClaimedSpans(int y, int width,
+                  const std::vector<cv::Range>& claimed_bands,
+                  std::vector<cv::Range>& spans)
+{
+    spans.clear();
+    
+    // Skip bands that end before the band intercept of the row's first pixel.
+    std::vector<cv::Range>::const_iterator band = claimed_bands.begin();
+    while (band != claimed_bands.end() && band->end <= y) {++band;}
+    
+    for (; band != claimed_bands.end(); ++band)
+    {
+        cv::Range claimed = wave_obj::BandRowSpan(y, *band, width);
+        if (claimed.start == width) {break;}
+        if (claimed.start != claimed.end)
+            spans.push_back(claimed);
+    }
+}
+
+// Args:
+//   claimed_spans: a const reference to the claimed spans of a row
+//   width: width of the binary image
+//   spans: a reference to a vector of column ranges
+// Operation:
+//   Replaces spans with the column ranges of the row, in increasing x order,
+//   that lie outside every claimed span.
+void UnclaimedSpans(const std::vector<cv::Range>& claimed_spans, int width,
+                    std::vector<cv::Range>& spans)
+{
+    spans.clear();
+    int x = 0;
+    
+    for (std::vector<cv::Range>::size_type i = 0; i != claimed_spans.size();
+         ++i)
+    {
+        if (claimed_spans[i].start > x)
+            spans.push_back(cv::Range(x, claimed_spans[i].start));
+        x = std::max(x, claimed_spans[i].end);
+    }
+    if (x != width)
+        spans.push_back(cv::Range(x, width));
+}
+
+// Args:
+//   row: pointer to a row of the binary image
+//   x_begin: first column to check
+//   x_end: one past the last column to check
+//   claimed_spans: a const reference to the claimed spans of the row
+// Operation:
+//   Returns true if any foreground pixel in columns [x_begin, x_end) of the
+//   row lies inside a claimed span.
+bool ClaimedForeground(const uchar* row, int x_begin, int x_end,
+                       const std::vector<cv::Range>& claimed_spans)
+{
+    for (std::vector<cv::Range>::size_type i = 0; i != claimed_spans.size();
+         ++i)
+    {
+        int x = std::max(x_begin, claimed_spans[i].start);
+        int end = std::min(x_end, claimed_spans[i].end);
+        for (; x < end; ++x)
+            if (row[x] != 0) {return true;}
+    }
+    return false;
+}
+
+// Args:
+//   binary_img: a const reference to a binary image
+//   row_begin: first row to label
+//   row_end: one past the last row to label
+//   claimed_bands: a const reference to sorted, disjoint claimed bands
+//   runs: a reference to an empty vector of runs
+//   sums: a reference to an empty vector of moment sums
+// Operation:
+//   Labels the 8-connected foreground components of rows [row_begin, row_end)
+//   of the binary image in a single raster pass, treating pixels inside the
+//   claimed bands as background.  Each row is split into runs of non-zero
+//   pixels, and each row's runs are joined to the touching runs of the previous
+//   row.  Moment sums are accumulated at the root of each component as runs
+//   are joined, so that on return every root run holds the moments of its
+//   whole component.  A run is marked as tracked if it touches claimed
+//   foreground on its own row or on the rows above and below it, which may lie
+//   outside [row_begin, row_end).  Claimed pixels are only read next to runs.
+void LabelComponents(const cv::Mat& binary_img, int row_begin, int row_end,
+                     const std::vector<cv::Range>& claimed_bands,
+                     std::vector<Run>& runs, std::vector<wave_obj::PixelMoments>& sums)
+{
+    // Runs of the previous row are [prev_begin, prev_end).
+    int prev_begin = 0;
+    int prev_end = 0;
+    std::vector<cv::Range> spans;
+    
+    // Claimed spans of the rows above, at and below the current row.
+    std::vector<cv::Range> claimed_above;
+    std::vector<cv::Range> claimed_row;
+    std::vector<cv::Range> claimed_below;
+    const int width = binary_img.cols;
+    if (row_begin > 0)
+        ClaimedSpans(row_begin - 1, width, claimed_bands, claimed_above);
+    if (row_begin != row_end)
+        ClaimedSpans(row_begin, width, claimed_bands, claimed_row);
+    
+    for (int y = row_begin; y != row_end; ++y)
+    {
+        const uchar* row = binary_img.ptr<uchar>(y);
+        const uchar* row_above = y > 0 ? binary_img.ptr<uchar>(y - 1) : 0;
+        const uchar* row_below = y + 1 < binary_img.rows ?
+                                 binary_img.ptr<uchar>(y + 1) : 0;
+        int cur_begin = static_cast<int>(runs.size());
+        
+        claimed_below.clear();
+        if (row_below != 0)
+            ClaimedSpans(y + 1, width, claimed_bands, claimed_below);
+        UnclaimedSpans(claimed_row, width, spans);
+        
+        for (std::vector<cv::Range>::size_type i = 0; i != spans.size(); ++i)
+        {
+            int x = spans[i].start;
+            
+            while (x != spans[i].end)
+            {
+                // Skip background, then find the end of the foreground run.
+                if (row[x] == 0) {++x; continue;}
+                
+                Run run;
+                run.y = y;
+                run.x_begin = x;
+                while (x != spans[i].end && row[x] != 0) {++x;}
+                run.x_end = x;
+                run.parent = static_cast<int>(runs.size());
+                
+                // Check the pixels that are 8-connected to the run.
+                int near_begin = std::max(run.x_begin - 1, 0);
+                int near_end = std::min(run.x_end + 1, width);
+                run.tracked =
+                    ClaimedForeground(row, near_begin, near_end,
+                                      claimed_row) ||
+                    (row_above != 0 &&
+                     ClaimedForeground(row_above, near_begin, near_end,
+                                       claimed_above)) ||
+                    (row_below != 0 &&
+                     ClaimedForeground(row_below, near_begin, near_end,
+                                       claimed_below));
+                
+                runs.push_back(run);
+                wave_obj::PixelMoments moms = {};
+                moms.add_run(run.y, run.x_begin, run.x_end);
+                sums.push_back(moms);
+            }
+        }
+        int cur_end = static_cast<int>(runs.size());
+        
+        JoinRows(runs, sums, prev_begin, prev_end, cur_begin, cur_end);
+        prev_begin = cur_begin;
+        prev_end = cur_end;
+        
+        claimed_above.swap(claimed_row);
+        claimed_row.swap(claimed_below);
+    }
+}
+
+// A horizontal tile of a binary image, labeled independently of the others.
+struct Tile {
+    int row_begin;
+    int row_end;
+    std::vector<Run> runs;
+    std::vector<wave_obj::PixelMoments> sums;
+};
+
+// Labels each tile in a range of tiles.  Tiles share no state, so OpenCV may
+// run the range on as many threads as it likes.
+class TileLabeler : public cv::ParallelLoopBody {
+  public:
+    TileLabeler(const cv::Mat& binary_img,
+                const std::vector<cv::Range>& claimed_bands,
+                std::vector<Tile>& tiles):
+        binary_img_(binary_img), claimed_bands_(claimed_bands), tiles_(tiles)
+        {}
+    
+    void operator()(const cv::Range& range) const
+    {
+        for (int t = range.start; t != range.end; ++t)
+            LabelComponents(binary_img_, tiles_[t].row_begin,
+                            tiles_[t].row_end, claimed_bands_, tiles_[t].runs,
+                            tiles_[t].sums);
+    }
+    
+  private:
+    const cv::Mat& binary_img_;
+    const std::vector<cv::Range>& claimed_bands_;
+    std::vector<Tile>& tiles_;
+};
+
 // Args:
-//   contour: a const reference to a contour,
+//   binary_img: a const reference to a binary image
+//   num_tiles: number of horizontal tiles to split the image into
+//   claimed_bands: a const reference to sorted, disjoint claimed bands
+//   runs: a reference to an empty vector of runs
+//   sums: a reference to an empty vector of moment sums
+// Operation:
+//   Labels the components of the binary image tile by tile in parallel, then
+//   concatenates the tiles in row order and joins the runs that touch across
+//   each tile border.  Run indices, roots and integer moment sums come out
+//   exactly as they do from a serial LabelComponents() of the whole image,
+//   because a component's root is always its lowest run index.
+void LabelComponentsTiled(const cv::Mat& binary_img, int num_tiles,
+                          const std::vector<cv::Range>& claimed_bands,
+                          std::vector<Run>& runs,
+                          std::vector<wave_obj::PixelMoments>& sums)
+{
+    std::vector<Tile> tiles(num_tiles);
+    for (int t = 0; t != num_tiles; ++t)
+    {
+        tiles[t].row_begin = binary_img.rows * t / num_tiles;
+        tiles[t].row_end = binary_img.rows * (t + 1) / num_tiles;
+    }
+    
+    // Label the tiles in parallel.
+    cv::parallel_for_(cv::Range(0, num_tiles),
+                      TileLabeler(binary_img, claimed_bands, tiles), num_tiles);
+    
+    // Concatenate the tiles, offsetting parents to global run indices.
+    std::vector<Run>::size_type total = 0;
+    for (int t = 0; t != num_tiles; ++t)
+        total += tiles[t].runs.size();
+    runs.reserve(total);
+    sums.reserve(total);
+    
+    // Runs of the last row of the previous tile are [prev_begin, prev_end).
+    int prev_begin = 0;
+    int prev_end = 0;
+    
+    for (int t = 0; t != num_tiles; ++t)
+    {
+        int offset = static_cast<int>(runs.size());
+        const std::vector<Run>& tile_runs = tiles[t].runs;
+        
+        for (std::vector<Run>::size_type i = 0; i != tile_runs.size(); ++i)
+        {
+            runs.push_back(tile_runs[i]);
+            runs.back().parent += offset;
+        }
+        sums.insert(sums.end(), tiles[t].sums.begin(), tiles[t].sums.end());
+        
+        // Join the first row of this tile to the last row of the previous.
+        int cur_begin = offset;
+        int cur_end = offset;
+        while (cur_end != static_cast<int>(runs.size()) &&
+               runs[cur_end].y == tiles[t].row_begin) {++cur_end;}
+        
+        if (prev_end != prev_begin && cur_end != cur_begin &&
+            runs[prev_begin].y + 1 == tiles[t].row_begin)
+            JoinRows(runs, sums, prev_begin, prev_end, cur_begin, cur_end);
+        
+        // Find the runs of the last row of this tile.
+        if (!tile_runs.empty())
+        {
+            prev_end = static_cast<int>(runs.size());
+            prev_begin = prev_end;
+            while (prev_begin != offset &&
+                   runs[prev_begin - 1].y == tiles[t].row_end - 1)
+                {--prev_begin;}
+        }
+    }
+}
+
+// Args:
+//   runs: a const reference to a labeled vector of runs
+//   width: width of the binary image
+//   claimed_bands: a reference to sorted, disjoint claimed bands
+// Operation:
+//   Removes from claimed_bands every band that a tracked run may touch, that
+//   is, every band that overlaps the intercepts of the pixels 8-connected to
+//   the run.  Returns true if any band was removed.
+bool OpenTouchedBands(const std::vector<Run>& runs, int width,
+                      std::vector<cv::Range>& claimed_bands)
+{
+    std::vector<cv::Range>::size_type num_bands = claimed_bands.size();
+    std::vector<bool> touched(num_bands, false);
+    bool any_touched = false;
+    
+    for (std::vector<Run>::size_type i = 0; i != runs.size(); ++i)
+    {
+        if (!runs[i].tracked) {continue;}
+        
+        // Intercepts grow to the right and downwards.
+        int low = wave_obj::BandIntercept(std::max(runs[i].x_begin - 1, 0),
+                                          runs[i].y - 1);
+        int high = wave_obj::BandIntercept(std::min(runs[i].x_end, width - 1),
+                                           runs[i].y + 1);
+        std::vector<cv::Range>::iterator band =
+                std::upper_bound(claimed_bands.begin(), claimed_bands.end(),
+                                 low, RangeStartsAfter);
+        if (band != claimed_bands.begin() && (band - 1)->end > low) {--band;}
+        
+        for (; band != claimed_bands.end() && band->start <= high; ++band)
+        {
+            touched[band - claimed_bands.begin()] = true;
+            any_touched = true;
+        }
+    }
+    
+    if (!any_touched) {return false;}
+    
+    std::vector<cv::Range>::size_type kept = 0;
+    for (std::vector<cv::Range>::size_type i = 0; i != num_bands; ++i)
+        if (!touched[i]) {claimed_bands[kept++] = claimed_bands[i];}
+    claimed_bands.resize(kept);
+    return true;
+}
+
+// Args:
+//   binary_img: a const reference to a binary image
+//   claimed_bands: a const reference to sorted, disjoint claimed bands
+//   runs: a reference to an empty vector of runs
+//   sums: a reference to an empty vector of moment sums
+// Operation:
+//   Labels the components of the whole binary image outside the claimed
+//   bands.  Large images are split into tiles labeled in parallel.  If any
+//   component touches foreground inside a claimed band, the bands it touches
+//   are opened and the image is labeled again, until no component touches a
+//   band that is still claimed.  Each component then holds all of the
+//   foreground connected to it, claimed or not, as it would without claims,
+//   and claimed foreground is only read in bands that untracked foreground
+//   runs into.
+void LabelImage(const cv::Mat& binary_img,
+                const std::vector<cv::Range>& claimed_bands,
+                std::vector<Run>& runs,
+                std::vector<wave_obj::PixelMoments>& sums)
+{
+    int num_tiles = std::min(cv::getNumThreads(),
+                             binary_img.rows / kMinTileRows);
+    std::vector<cv::Range> closed_bands(claimed_bands);
+    
+    do {
+        runs.clear();
+        sums.clear();
+        if (binary_img.rows * binary_img.cols >=
+            preprocessing::kMinParallelArea && num_tiles > 1)
+            LabelComponentsTiled(binary_img, num_tiles, closed_bands, runs,
+                                 sums);
+        else
+            LabelComponents(binary_img, 0, binary_img.rows, closed_bands,
+                            runs, sums);
+    } while (OpenTouchedBands(runs, binary_img.cols, closed_bands));
+}
+
+// Args:
+//   moms: a const reference to the moments of a section,
 //   min_area: a minimum area threshold
 //   min_inertia_ratio: a minimum inertia ratio
 //   max_inertia_ratio: and a maximum inertia ratio
 // Operation:
-//   Returns true if contour meets threshold requirements, and false if it does
-//   not.  "Inertia" measures the oblong shape of a contour.  In our case,
-//   we are looking for long and narrow contours.
-bool KeepContour(const std::vector<cv::Point>& contour, int min_area,
+//   Returns true if section meets threshold requirements, and false if it does
+//   not.  "Inertia" measures the oblong shape of a section.  In our case,
+//   we are looking for long and narrow sections.
+bool KeepSection(const cv::Moments& moms, int min_area,
                  double min_inertia_ratio, double max_inertia_ratio)
 {
     bool ret = true;
     
-    // Get the moments.
-    cv::Moments moms = moments(cv::Mat(contour));
-    
     // Filter by area:
     if (ret == true)
     {
         double area = moms.m00;
-        if (area < kMinArea)
+        if (area < min_area)
             ret = false;
     }
     
@@ -79,7 +540,7 @@ bool KeepContour(const std::vector<cv::Point>& contour, int min_area,
             ratio = 1;
         }
         
-        if (ratio < kMinInertiaRatio || ratio >= kMaxInertiaRatio)
+        if (ratio < min_inertia_ratio || ratio >= max_inertia_ratio)
             ret = false;
     }
     return ret;
@@ -92,65 +553,164 @@ bool KeepContour(const std::vector<cv::Point>& contour, int min_area,
 namespace detection {
     
 // Args:
-//   contours: a reference to a vector of opencv contours
-//   waves: a reference to a vector of Wave objects
-//   frame_number: an integer representing the frame in a video sequence
+//   binary_image: a const reference to a binary image
+//   claimed_bands: a const reference to sorted, disjoint claimed bands
+//   components: a reference to the components of the frame
 // Operation:
-//   Filters the contours, converts accepted contours, and appends them to the
-//   vector of Waves.  Destroys unacceptable contours.
-void FilterAndConvert(std::vector<std::vector<cv::Point> >& contours,
-                      std::vector<wave_obj::Wave>& waves, int frame_number)
-{    
-    // Init a counter for iterator.
-    std::vector<std::vector<cv::Point> >::size_type i =0;
-    
-    // Filter the contours and make vector of Wave objects
-    while (i != contours.size()){
-        if (KeepContour(contours[i], kMinArea, kMinInertiaRatio,
-                        kMaxInertiaRatio))
-        {
-            waves.push_back(wave_obj::Wave(contours[i], frame_number));
-            ++i;
-        } else {
-            contours.erase(contours.begin() + i);
-        }
-    }
+//   Labels the binary image outside the claimed bands (See: LabelImage), and
+//   replaces the components with the moments of each labeled component.
+void LabelFrame(const cv::Mat& binary_image,
+                const std::vector<cv::Range>& claimed_bands,
+                Components& components)
+{
+    // Init vectors that will hold foreground runs and their moment sums.
+    std::vector<Run> runs;
+    std::vector<wave_obj::PixelMoments> sums;
+    
+    // Label connected components in binary image, accumulating moments.
+    LabelImage(binary_image, claimed_bands, runs, sums);
+    
+    // Only the root run of a component holds its moments.
+    components.moments.clear();
+    for (std::vector<Run>::size_type i = 0; i != runs.size(); ++i)
+        if (runs[i].parent == static_cast<int>(i))
+            components.moments.push_back(sums[i]);
+    components.labeled = true;
 }
 
-// Args::
-//   contours: a reference to empty vector of contours
-//   binary_img: a const reference to a binary image.
+// Args:
+//   components: a const reference to the moments of labeled components
+//   sections: a reference to a vector of Section records
+//   frame_number: an integer representing the frame in a video sequence
 // Operation:
-//   Appends found contours in the binary image to the vector of contours.
-void FindContoursBasic(std::vector<std::vector<cv::Point> >& contours,
-                       const cv::Mat& binary_img)
+//   Filters the labeled components, converts accepted components, and appends
+//   them to the vector of Sections, in the order of the components.
+void FilterAndConvert(const std::vector<wave_obj::PixelMoments>& components,
+                      std::vector<wave_obj::Section>& sections,
+                      int frame_number)
 {
-    // Return detected shapes to contours container.
-    cv::findContours(binary_img, contours, cv::RETR_LIST, CV_CHAIN_APPROX_NONE);
+    for (std::vector<wave_obj::PixelMoments>::size_type i = 0;
+         i != components.size(); ++i)
+    {
+        const wave_obj::PixelMoments& s = components[i];
+        cv::Moments moms(static_cast<double>(s.m00), static_cast<double>(s.m10),
+                         static_cast<double>(s.m01), static_cast<double>(s.m20),
+                         static_cast<double>(s.m11), static_cast<double>(s.m02),
+                         0, 0, 0, 0);
+        
+        if (!KeepSection(moms, kMinArea, kMinInertiaRatio, kMaxInertiaRatio))
+            continue;
+        
+        wave_obj::Section section;
+        section.birth = frame_number;
+        section.m00 = moms.m00;
+        section.m10 = moms.m10;
+        section.m01 = moms.m01;
+        section.mu20 = moms.mu20;
+        section.mu11 = moms.mu11;
+        section.mu02 = moms.mu02;
+        section.centroid_x = static_cast<int>(moms.m10 / moms.m00);
+        section.centroid_y = static_cast<int>(moms.m01 / moms.m00);
+        section.band_intercept = wave_obj::BandIntercept(section.centroid_x,
+                                                         section.centroid_y);
+        sections.push_back(section);
+    }
 }
 
 // Args:
 //   binary_image: a const reference to a binary image
 //   frame_number: a frame number as an int
+//   claimed_bands: a const reference to sorted, disjoint bands of intercepts
+//                  already claimed by tracked waves
+//   labeled: a pointer to the components of the frame, or null
 // Operations:
-//   Returns a vector of Wave objects.
-std::vector<wave_obj::Wave> DetectSections(const cv::Mat& binary_image,
-                                           int frame_number)
+//   Returns a vector of Section records found outside the claimed bands,
+//   labeling the frame unless its components are given.
+std::vector<wave_obj::Section> DetectSections(
+        const cv::Mat& binary_image, int frame_number,
+        const std::vector<cv::Range>& claimed_bands,
+        const Components* labeled)
 {
-    // Init a vector that will hold OpenCV contour objects.
-    std::vector<std::vector<cv::Point> > contours;
-    
-    // Find contours in binary image and return to contours.
-    FindContoursBasic(contours, binary_image);
+    // Label the frame, unless DetectionDue() already has.
+    Components components;
+    if (labeled == 0 || !labeled->labeled)
+    {
+        LabelFrame(binary_image, claimed_bands, components);
+        labeled = &components;
+    }
     
     // Init a vector that will hold sections.
-    std::vector<wave_obj::Wave> sections;
+    std::vector<wave_obj::Section> sections;
     
-    // Filter the contours, converting the ones we keep to sections.
-    FilterAndConvert(contours, sections, frame_number);
+    // Filter the components, converting the ones we keep to sections.
+    FilterAndConvert(labeled->moments, sections, frame_number);
     
     // Return the sections.
     return sections;
 };
     
+// Args:
+//   binary_image: a const reference to a binary image
+//   claimed_bands: a const reference to sorted, disjoint bands of intercepts
+//                  already claimed by tracked waves
+//   frames_since_detection: frames elapsed since DetectSections() last ran
+//   cadence: number of frames between scheduled detections
+//   components: a reference to the components of the frame
+// Operation:
+//   Counts the foreground outside the claimed bands, stopping as soon as the
+//   count reaches the trigger area.  Returns false if the count is below the
+//   minimum section area, as no section could be found, and true if a
+//   scheduled detection is due.  Otherwise, a count that reaches the trigger
+//   area is confirmed by labeling the foreground outside the claimed bands:
+//   only components whose centers of mass lie outside the claimed bands, and
+//   so would be promoted to new waves, count towards the trigger.  Components
+//   that continue into a claimed band are labeled with the claimed foreground
+//   they touch, so the spill of a tracked wave past its band does not count.
+//   The labeled components are kept for DetectSections().
+bool DetectionDue(const cv::Mat& binary_image,
+                  const std::vector<cv::Range>& claimed_bands,
+                  int frames_since_detection, int cadence,
+                  Components& components)
+{
+    components.labeled = false;
+    
+    int count = 0;
+    std::vector<cv::Range> claimed_spans;
+    std::vector<cv::Range> spans;
+    
+    for (int y = 0; y != binary_image.rows && count < kDetectionTriggerArea;
+         ++y)
+    {
+        const uchar* row = binary_image.ptr<uchar>(y);
+        ClaimedSpans(y, binary_image.cols, claimed_bands, claimed_spans);
+        UnclaimedSpans(claimed_spans, binary_image.cols, spans);
+        
+        for (std::vector<cv::Range>::size_type i = 0; i != spans.size(); ++i)
+            for (int x = spans[i].start; x != spans[i].end; ++x)
+                count += (row[x] != 0);
+    }
+    
+    if (count < kMinArea)
+        return false;
+    if (frames_since_detection >= cadence)
+        return true;
+    if (count < kDetectionTriggerArea)
+        return false;
+    
+    LabelFrame(binary_image, claimed_bands, components);
+    
+    long long untracked_area = 0;
+    for (std::vector<wave_obj::PixelMoments>::size_type i = 0;
+         i != components.moments.size(); ++i)
+    {
+        const wave_obj::PixelMoments& s = components.moments[i];
+        if (!InClaimedBand(wave_obj::BandIntercept(
+                                   static_cast<int>(s.m10 / s.m00),
+                                   static_cast<int>(s.m01 / s.m00)),
+                           claimed_bands))
+            untracked_area += s.m00;
+    }
+    return untracked_area >= kDetectionTriggerArea;
+}
+
 }  // namespace detection
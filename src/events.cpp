@@ -0,0 +1,150 @@
+//
+//  file:       events.cpp
+//
+//  project:    Multiple Wave Tracking
+//
+//  contents:   Definitions of the wave event queue and dispatcher.  Associated
+//              header file is events.hpp.
+//
+//  use:        see readme.txt
+//
+
+#include "events.hpp"
+
+
+// ---EXTERNAL LINKAGE---
+namespace events {
+
+//---EVENT QUEUE---
+
+// Makes an empty queue.
+//
+// Args:
+//   capacity: least number of events the queue holds
+// Example:
+//   events::EventQueue queue(256);
+//   queue.push(event);
+EventQueue::EventQueue(int capacity):
+    slots_(),
+    mask_(0),
+    head_(0),
+    tail_(0),
+    dropped_(0)
+{
+    size_t size = 1;
+    while (size < static_cast<size_t>(capacity))
+        size *= 2;
+    slots_.resize(size);
+    mask_ = size - 1;
+}
+
+// Args:
+//   event: an event
+// Operation:
+//   Writes the event into the next free slot, then publishes it to the
+//   consumer by advancing the tail.
+bool EventQueue::push(const WaveEvent& event)
+{
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == slots_.size())
+    {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    slots_[tail & mask_] = event;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+// Args:
+//   event: a reference to hold the event taken
+// Operation:
+//   Reads the oldest published event, then frees its slot for the producer
+//   by advancing the head.
+bool EventQueue::pop(WaveEvent& event)
+{
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire))
+        return false;
+    event = slots_[head & mask_];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+
+//---EVENT DISPATCHER---
+
+// Starts the dispatching thread.
+//
+// Args:
+//   queue: the queue to deliver events from
+//   observer: the observer to deliver events to
+// Example:
+//   events::EventDispatcher dispatcher(queue, observer);
+//   queue.push(event);
+//   dispatcher.notify();
+EventDispatcher::EventDispatcher(EventQueue& queue, WaveObserver& observer):
+    queue_(queue),
+    observer_(observer),
+    signaled_(false),
+    stopping_(false)
+{
+    thread_ = std::thread(&EventDispatcher::run, this);
+}
+
+// Operation:
+//   Stops the dispatching thread once it has delivered the events left in
+//   the queue.
+EventDispatcher::~EventDispatcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+}
+
+// Operation:
+//   Marks the thread as signaled and wakes it.  Since the thread clears the
+//   mark before draining the queue, no event pushed before a notification is
+//   left undelivered.
+void EventDispatcher::notify()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        signaled_ = true;
+    }
+    wake_.notify_one();
+}
+
+// Operation:
+//   Sleeps until notified, then delivers every event in the queue to the
+//   observer, in order.
+void EventDispatcher::run()
+{
+    WaveEvent event;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+        wake_.wait(lock, [this] {return signaled_ || stopping_;});
+        bool stopping = stopping_;
+        signaled_ = false;
+        lock.unlock();
+
+        while (queue_.pop(event))
+        {
+            switch (event.type)
+            {
+                case kBirth: observer_.on_birth(event); break;
+                case kRecognition: observer_.on_recognition(event); break;
+                case kDeath: observer_.on_death(event); break;
+            }
+        }
+
+        if (stopping) {break;}
+        lock.lock();
+    }
+}
+
+}   // namespace events
@@ -18,41 +18,96 @@
 #include <string>
 #include <fstream>
 #include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
 #include <time.h>
 
 #include "opencv2/opencv.hpp"
 #include "opencv2/videoio.hpp"
 
+#include "archive.hpp"
+#include "events.hpp"
 #include "preprocessing.hpp"
+#include "shared_state.hpp"
 #include "detection.hpp"
 #include "wave_objects.hpp"
 #include "tracking.hpp"
+#include "pipeline.hpp"
 
 using namespace std::chrono;
 
 
-// Declare file name of the video.
+// Declare file name of the video, unless one is passed on the command line.
 const std::string kInputVidName = "tstreet.mp4";
 const std::string kOutputVidName = "output.mp4";
 
-// Set output frame sizes
-const int kOutputWidth = 320;
-const int kOutputHeight = 180;
+// Declare file name of the archive of recognized waves (See: archive.hpp),
+// unless another is passed with --archive, or --no-archive is passed.
+const std::string kArchiveName = "waves.mwta";
+
+// Declare name of the shared-memory segment that the state of the tracked
+// waves is published to when run with --publish (See: shared_state.hpp).
+const std::string kStateName = "/mwt_state";
+
+// Set output frame sizes to that of the analysis frames drawn on.
+const int kOutputWidth = preprocessing::kAnalysisWidth;
+const int kOutputHeight = preprocessing::kAnalysisHeight;
+
+// Run birth detection at least every kDetectionCadence frames, unless another
+// cadence is passed with --detection-cadence.  Tracking runs on every frame
+// regardless.  The default of 1 births every wave in the frame it first
+// appears in, which is the birth frame that the archive and the birth events
+// report.  It still skips detection on frames with too little untracked
+// foreground to make up a section.  Longer cadences also skip the labeling of
+// the frames in between, but find waves up to cadence - 1 frames late, and
+// have not yet been shown to leave the recognized waves of the scenes
+// unchanged; check them with tools/compare_scenes.sh before raising the
+// default.
+const int kDetectionCadence = 1;
+
+// Method of computing the display bounding boxes of tracked waves, unless
+// another is passed with --box-mode exact|moment.  The exact minimum-area box
+// needs each wave's pixel runs; the moment-based box does not.  Compare their
+// costs with the "track" and "output" stage timings of runs in each mode.
+const wave_obj::BoxMode kBoxMode = wave_obj::kExactBox;
+
+// Source of the moments of tracked waves whose runs are not needed, unless
+// another is passed with --band-sums auto|on|off: chosen per frame, or always
+// (on) or never (off) looked up from prefix sums of the frame over band
+// intercepts (See: tracking::MomentSource).
+const tracking::MomentSource kMomentSource = tracking::kAutoMoments;
+
+// Headless builds (cmake -DMWT_HEADLESS=ON) never write an output video nor
+// compute display-only wave geometry.  Other builds run headless when passed
+// the --headless flag.
+#ifdef MWT_HEADLESS
+const bool kHeadlessBuild = true;
+#else
+const bool kHeadlessBuild = false;
+#endif
+
+// Guards stdio, which the thread delivering wave events (See: EventLogger)
+// writes to alongside the main thread, so their lines never interleave.
+std::mutex stdio_mutex;
 
 
 // Simple log for output.
 // Args:
 //   begin_time: time in milliseconds
 //   end_time: time in milliseconds
-//   rec_waves: a vector of Wave objects
+//   num_waves: number of recognized waves
 //   num_frames: number of frames in a video sequence
+//   num_dropped_events: number of wave events dropped by a full event queue
 // Opertion:
 //   Simple log to report to stdio of program performance and waves identified.
 void WriteLog(high_resolution_clock::time_point begin_time,
               high_resolution_clock::time_point end_time,
-              std::vector<wave_obj::Wave> waves,
-              int num_frames)
+              int num_waves,
+              int num_frames,
+              long long num_dropped_events)
 {
+    std::lock_guard<std::mutex> lock(stdio_mutex);
     std::cout << "------------" << std::endl;
     std::cout << "Program complete." << std::endl;
     std::cout << "Program took "
@@ -61,7 +116,10 @@ void WriteLog(high_resolution_clock::time_point begin_time,
     std::cout << "Program speed: " << static_cast<double>(num_frames) /
                         duration_cast<seconds>(end_time-begin_time).count()
               << " frames per second." << std::endl;
-    std::cout << waves.size() << " wave(s) found." << std::endl;
+    std::cout << num_waves << " wave(s) found." << std::endl;
+    if (num_dropped_events != 0)
+        std::cout << num_dropped_events << " wave event(s) dropped because "
+                  << "the event queue was full." << std::endl;
     std::cout << "------------" << std::endl;
     //std::cout << "DEBUGGING" << std::endl;
     //std::cout << "Time spent in reading frames: " << sec << " milliseconds."
@@ -69,17 +127,62 @@ void WriteLog(high_resolution_clock::time_point begin_time,
 }
 
 
+// Report of the time spent in each stage of the analysis.
+// Args:
+//   graph: the task graph of the stages of the analysis of a frame
+// Operation:
+//   Reports to stdio the mean time per frame of each node of the graph.
+void WriteStageTimings(const pipeline::TaskGraph& graph)
+{
+    if (graph.runs() == 0) {return;}
+
+    std::lock_guard<std::mutex> lock(stdio_mutex);
+    std::cout << "Mean time per frame of each stage:" << std::endl;
+    for (int i = 0; i != graph.size(); ++i)
+        std::cout << "  " << graph.name(i) << ": "
+                  << graph.total_milliseconds(i) / graph.runs()
+                  << " milliseconds." << std::endl;
+    std::cout << "------------" << std::endl;
+}
+
+
+// Simple observer of wave events for output.
+// Operation:
+//   Reports to stdio each wave as it is recognized, and each recognized wave
+//   as it dies.  Runs on the thread of an events::EventDispatcher, so it holds
+//   stdio_mutex while it writes.
+class EventLogger : public events::WaveObserver {
+  public:
+    void on_recognition(const events::WaveEvent& event)
+    {
+        std::lock_guard<std::mutex> lock(stdio_mutex);
+        std::cout << "Wave " << event.name << " recognized in frame "
+                  << event.frame << "." << std::endl;
+    }
+
+    void on_death(const events::WaveEvent& event)
+    {
+        if (!event.recognized) {return;}
+
+        std::lock_guard<std::mutex> lock(stdio_mutex);
+        std::cout << "Wave " << event.name << " ended in frame "
+                  << event.frame << " (max mass " << event.max_mass << ")."
+                  << std::endl;
+    }
+};
+
+
 // Simple Debugger that outputs tracked wave statistics.
 // Args:
-//   waves: a vector of Wave obejcts
+//   waves: a pool of Wave obejcts
 // Opertion:
 //   Displays tracked waves statistics to stdio.  Useful for monitoring
 //   behavior of the detection and tracking routines.
-void WaveDebugger(std::vector<wave_obj::Wave> waves)
+void WaveDebugger(const wave_obj::WavePool& waves)
 {
     std::cout << "Tracking " << waves.size() << " waves..." << std::endl;
 
-    for (std::vector<wave_obj::Wave>::size_type i = 0; i != waves.size(); ++i)
+    for (int i = 0; i != waves.size(); ++i)
     {
         std::cout << "id: " << waves[i].name_ << std::endl;
         //cout << "original axis: " << waves[i].original_axis[0]
@@ -87,17 +190,95 @@ void WaveDebugger(std::vector<wave_obj::Wave> waves)
         // << ", " << waves[i].original_axis[2] << endl;
         //cout << "centroid: " << waves[i].centroid << endl;
         std::cout << "centroid deque size: "
-                  << waves[i].centroid_vec_.size() << std::endl;
+                  << waves[i].centroid_history().size() << std::endl;
         //cout << "disp: " << waves[i].displacement << endl;
-        std::cout << "max_disp: " << waves[i].max_displacement_ << std::endl;
-        std::cout << "mass: " << waves[i].mass_ << std::endl;
-        std::cout << "max_mass: " << waves[i].max_mass_ << std::endl;
-        std::cout << "recognized: " << waves[i].recognized_ << std::endl;
-        std::cout << "death: " << waves[i].death_ << std::endl;
+        std::cout << "max_disp: " << waves[i].max_displacement() << std::endl;
+        std::cout << "mass: " << waves[i].mass() << std::endl;
+        std::cout << "max_mass: " << waves[i].max_mass() << std::endl;
+        std::cout << "recognized: " << waves[i].recognized() << std::endl;
+        std::cout << "death: " << waves[i].death() << std::endl;
     }
 }
 
 
+// Report of the cost of drawing bounding boxes.
+// Args:
+//   box_mode: the method of computing bounding boxes
+//   num_boxes: number of bounding boxes drawn
+//   output_ms: total time of the output stage in milliseconds
+// Operation:
+//   Reports to stdio the time of the output stage per box drawn.
+void WriteBoxCost(wave_obj::BoxMode box_mode, long long num_boxes,
+                  double output_ms)
+{
+    if (num_boxes == 0) {return;}
+
+    std::lock_guard<std::mutex> lock(stdio_mutex);
+    std::cout << num_boxes << " "
+              << (box_mode == wave_obj::kExactBox ? "exact" : "moment")
+              << " bounding box(es) drawn; "
+              << 1000 * output_ms / num_boxes
+              << " microseconds of output per box." << std::endl;
+    std::cout << "------------" << std::endl;
+}
+
+
+// Overlays tracked waves on the binary image and writes it to the output.
+// Args:
+//   writer: an opened VideoWriter object
+//   binary_image: the binary image of the current frame
+//   waves: a pool of tracked Wave objects
+//   box_mode: the method of computing bounding boxes
+// Operation:
+//   Draws the bounding box of each wave over a copy of the binary image, and
+//   writes the copy to the output video.  Bounding boxes are only computed
+//   here, on demand.  Returns the number of boxes drawn.
+int WriteOutputFrame(cv::VideoWriter& writer, const cv::Mat& binary_image,
+                     wave_obj::WavePool& waves, wave_obj::BoxMode box_mode)
+{
+    cv::Mat output = binary_image.clone();
+    int num_boxes = 0;
+
+    for (int i = 0; i != waves.size(); ++i)
+    {
+        const cv::Point2f* box = waves[i].boundingbox_coors(box_mode);
+        if (box == 0) {continue;}
+
+        for (int j = 0; j != 4; ++j)
+            cv::line(output, box[j], box[(j + 1) % 4], cv::Scalar(128));
+        ++num_boxes;
+    }
+    writer.write(output);
+    return num_boxes;
+}
+
+
+// Publishes the tracked waves to shared memory.
+// Args:
+//   publisher: an opened StatePublisher object
+//   frame_number: a frame number as an integer
+//   waves: a pool of tracked Wave objects
+//   states: a reference to a vector to hold the states of the waves
+// Operation:
+//   Copies the name, centroid, mass and recognition of each wave into states,
+//   and publishes them as the snapshot of the frame.
+void PublishState(shared_state::StatePublisher& publisher, int frame_number,
+                  const wave_obj::WavePool& waves,
+                  std::vector<shared_state::WaveState>& states)
+{
+    states.resize(waves.size());
+    for (int i = 0; i != waves.size(); ++i)
+    {
+        states[i].name = waves[i].name_;
+        states[i].centroid_x = waves[i].centroid().x;
+        states[i].centroid_y = waves[i].centroid().y;
+        states[i].mass = waves[i].mass();
+        states[i].recognized = waves[i].recognized() ? 1 : 0;
+    }
+    publisher.publish(frame_number, states);
+}
+
+
 // Simple status update to stdio.
 // Args:
 //   frame_num: frame being analyzed
@@ -108,6 +289,7 @@ void status_update(int frame_num, int tot_frames,
                    high_resolution_clock::time_point begin_time,
                    high_resolution_clock::time_point curr_time)
 {
+    std::lock_guard<std::mutex> lock(stdio_mutex);
     if (frame_num == 1)
         std::cout << "Starting analysis of " << tot_frames <<
         " frames." << std::endl;
@@ -127,9 +309,45 @@ void status_update(int frame_num, int tot_frames,
 
 int main(int argc, const char** argv)
 {
+    // Headless runs skip all output and display-only computation.  Runs that
+    // publish share the state of the tracked waves with other processes.
+    // Runs without claims detect over the whole frame, as a reference for the
+    // claimed-band detection (See: tools/compare_scenes.sh).  An argument that
+    // is not a flag names the input video.
+    std::string input_name = kInputVidName;
+    std::string archive_name = kArchiveName;
+    bool headless = kHeadlessBuild;
+    bool publish = false;
+    bool use_claims = true;
+    int detection_cadence = kDetectionCadence;
+    wave_obj::BoxMode box_mode = kBoxMode;
+    tracking::MomentSource moment_source = kMomentSource;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+        if (arg == "--headless") {headless = true;}
+        else if (arg == "--publish") {publish = true;}
+        else if (arg == "--no-claims") {use_claims = false;}
+        else if (arg == "--archive" && i + 1 < argc) {archive_name = argv[++i];}
+        else if (arg == "--no-archive") {archive_name.clear();}
+        else if (arg == "--detection-cadence" && i + 1 < argc)
+            detection_cadence = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--box-mode" && i + 1 < argc)
+            box_mode = std::string(argv[++i]) == "moment" ?
+                       wave_obj::kMomentBox : wave_obj::kExactBox;
+        else if (arg == "--band-sums" && i + 1 < argc)
+        {
+            std::string value(argv[++i]);
+            moment_source = value == "on" ? tracking::kBandSumMoments :
+                            value == "off" ? tracking::kSweepMoments :
+                            tracking::kAutoMoments;
+        }
+        else if (arg.compare(0, 2, "--") != 0) {input_name = arg;}
+    }
+
     // ---INPUT---
     // Init OpenCV VideoCapture object and check for errors.
-    cv::VideoCapture cap(kInputVidName);
+    cv::VideoCapture cap(input_name);
     if (!cap.isOpened()) {
         std::cerr << "Error opening video stream or file." << std::endl;
         return -1;
@@ -138,15 +356,56 @@ int main(int argc, const char** argv)
 
     // ---OUTPUT---
     // Initialize a VideoWriter object and check for success.
-    int fourcc = CV_FOURCC('M','P','4','V');
-    double fps = cap.get(cv::CAP_PROP_FPS);
-    cv::Size S = cv::Size(kOutputWidth, kOutputHeight);
-    bool is_color = false;
     cv::VideoWriter writer;
-    writer = cv::VideoWriter(kOutputVidName, fourcc, fps, S, is_color);
-    if (!writer.isOpened()) {
-        std::cerr << "Could not open the output video file for write\n";
-        return -1;
+    if (!headless) {
+        int fourcc = CV_FOURCC('M','P','4','V');
+        double fps = cap.get(cv::CAP_PROP_FPS);
+        cv::Size S = cv::Size(kOutputWidth, kOutputHeight);
+        bool is_color = false;
+        writer = cv::VideoWriter(kOutputVidName, fourcc, fps, S, is_color);
+        if (!writer.isOpened()) {
+            std::cerr << "Could not open the output video file for write\n";
+            return -1;
+        }
+    }
+
+    // Waves keep their pixel runs only for exact boxes drawn to the output.
+    tracking::TrackOptions track_options;
+    track_options.keep_runs = !headless && box_mode == wave_obj::kExactBox;
+    track_options.moment_source = moment_source;
+
+    // ---ARCHIVE---
+    // Open the archive that recognized waves are written to as they die.  A
+    // run whose archive cannot be opened, such as a file that is not an
+    // archive of the current format, still tracks, without archiving.
+    std::unique_ptr<archive::ArchiveWriter> wave_archive;
+    if (!archive_name.empty()) {
+        wave_archive.reset(new archive::ArchiveWriter(archive_name));
+        if (!wave_archive->is_open()) {
+            std::cerr << "Could not open " << archive_name << " as a wave "
+                      << "archive for append; recognized waves will not be "
+                      << "archived (move the file aside, or pass --archive "
+                      << "PATH or --no-archive)\n";
+            wave_archive.reset();
+        }
+    }
+
+    // ---SHARED STATE---
+    // Create the shared-memory segment that other processes read the tracked
+    // waves from.
+    std::unique_ptr<shared_state::StatePublisher> state_publisher;
+    if (publish) {
+        state_publisher.reset(new shared_state::StatePublisher(kStateName));
+        if (state_publisher->in_use()) {
+            std::cerr << "The shared state segment " << kStateName
+                      << " is in use by another tracker; stop it before "
+                      << "publishing\n";
+            return -1;
+        }
+        if (!state_publisher->is_open()) {
+            std::cerr << "Could not create the shared state segment\n";
+            return -1;
+        }
     }
 
     // ---PREPROCESSING---
@@ -156,14 +415,120 @@ int main(int argc, const char** argv)
     preprocessing::InitializePreprocessing(pMOG, morphological_kernel);
 
     // ---ANALYSIS---
-    // Init OpenCV frame, binary_image, and vector of Waves objects.
+    // Init OpenCV frame, binary_image, the pool of tracked Wave objects, the
+    // index of their search bands, the storage that tracking reuses between
+    // frames, the bands that detection skips, the components labeled in
+    // deciding whether to detect, the sections detected in the current frame,
+    // and the summaries of waves recognized in the current frame.
     cv::Mat frame;
     cv::Mat binary_image;
-    std::vector<wave_obj::Wave> tracked_waves;
-    std::vector<wave_obj::Wave> recognized_waves;
-
-    // Init a frame number counter.
+    wave_obj::WavePool tracked_waves;
+    tracking::BandIndex band_index;
+    tracking::TrackingBuffers tracking_buffers;
+    std::vector<cv::Range> claimed_bands;
+    detection::Components components;
+    std::vector<wave_obj::Section> new_sections;
+    std::vector<wave_obj::WaveSummary> recognized_waves;
+
+    // Init a frame number counter, the frame of the last detection, and a
+    // count of recognized waves.
     int frame_number = 1;
+    int num_recognized_waves = 0;
+    int last_detection_frame = 0;
+
+    // ---EVENTS---
+    // Deliver the births, recognitions and deaths of waves to an observer on a
+    // thread of its own, as they happen.
+    events::EventQueue wave_events;
+    EventLogger event_logger;
+    events::EventDispatcher event_dispatcher(wave_events, event_logger);
+
+    // ---STAGES---
+    // Build the graph of the stages of the analysis of a frame.  Detection and
+    // tracking both need only the binary image and the predicted search bands
+    // of the tracked waves, so they run concurrently on frames where detection
+    // is due.  On other frames tracking runs alone, with the whole thread
+    // pool.
+    pipeline::TaskGraph stages;
+
+    // Only search foreground that no tracked wave's search band claims.  Waves
+    // that die or turn out to be duplicates in this frame still claim their
+    // bands: a dead wave's band holds no foreground, and a duplicate's band
+    // is being tracked.  The bands are predicted from the previous frames, in
+    // little time, so prediction runs before preprocessing rather than beside
+    // it, and preprocessing keeps the thread pool.
+    int predict = stages.add_node("predict", [&] {
+        tracking::PredictSearchRegions(tracked_waves);
+        band_index.update(tracked_waves);
+        if (use_claims)
+            claimed_bands = band_index.claimed();
+    });
+
+    int preprocess = stages.add_node("preprocess", [&] {
+        preprocessing::Preprocess(frame, binary_image, pMOG,
+                                  morphological_kernel);
+    }, {predict});
+
+    int track = stages.add_node("track", [&] {
+        tracking::TrackWaves(tracked_waves, binary_image, frame_number,
+                             number_of_frames, tracking_buffers,
+                             track_options, &wave_events);
+    }, {preprocess});
+
+    // Only detect on frames where a new section may have appeared.
+    int detect = stages.add_node("detect", [&] {
+        new_sections = detection::DetectSections(binary_image, frame_number,
+                                                 claimed_bands, &components);
+        last_detection_frame = frame_number;
+    }, {preprocess}, [&] {
+        return frame_number < number_of_frames &&
+               detection::DetectionDue(binary_image, claimed_bands,
+                                       frame_number - last_detection_frame,
+                                       detection_cadence, components);
+    });
+
+    // Archive the waves that were recognized and died in this frame.
+    int remove_dead = stages.add_node("remove dead", [&] {
+        tracking::RemoveDeadWaves(tracked_waves, recognized_waves,
+                                  &wave_events);
+        for (std::vector<wave_obj::WaveSummary>::size_type i = 0;
+             wave_archive && i != recognized_waves.size(); ++i)
+            wave_archive->append(recognized_waves[i]);
+        num_recognized_waves += recognized_waves.size();
+        recognized_waves.clear();
+    }, {track});
+
+    int dedup = stages.add_node("dedup", [&] {
+        tracking::RemoveDuplicateWaves(tracked_waves, tracking_buffers,
+                                       &wave_events, frame_number);
+    }, {remove_dead});
+
+    // Promote the new sections that are not already tracked, against the
+    // bands of the waves that survived this frame.
+    int merge = stages.add_node("merge", [&] {
+        band_index.update(tracked_waves);
+        tracking::AddNewSectionsToTrackedWaves(new_sections, tracked_waves,
+                                               band_index, &wave_events);
+        new_sections.clear();
+    }, {detect, dedup});
+
+    // Publish the waves tracked at the end of the frame.
+    std::vector<shared_state::WaveState> wave_states;
+    int last_stage = merge;
+    if (state_publisher)
+        last_stage = stages.add_node("publish", [&] {
+            PublishState(*state_publisher, frame_number, tracked_waves,
+                         wave_states);
+        }, {merge});
+
+    // Write to output, with tracked waves drawn over the binary image.
+    long long num_boxes = 0;
+    int output = -1;
+    if (!headless)
+        output = stages.add_node("output", [&] {
+            num_boxes += WriteOutputFrame(writer, binary_image, tracked_waves,
+                                          box_mode);
+        }, {last_stage});
 
     // Init a timer for program performance.
     auto t1 = high_resolution_clock::now();
@@ -178,21 +543,9 @@ int main(int argc, const char** argv)
         status_update(frame_number, number_of_frames,
                       t1, high_resolution_clock::now());
 
-        // ---PREPROCESS---
-        preprocessing::Preprocess(frame, binary_image, pMOG,
-                                  morphological_kernel);
-
-        // ---DETECTION---
-        std::vector<wave_obj::Wave> tmp_sections = detection::DetectSections(
-                binary_image, frame_number);
-
-        // ---TRACKING---
-        tracking::TrackWaves(tracked_waves, binary_image, frame_number,
-                             number_of_frames);
-        tracking::RemoveDeadWaves(tracked_waves, recognized_waves);
-        tracking::RemoveDuplicateWaves(tracked_waves);
-        if (frame_number < number_of_frames)
-            tracking::AddNewSectionsToTrackedWaves(tmp_sections, tracked_waves);
+        // ---PREPROCESS, TRACKING, DETECTION AND OUTPUT---
+        stages.run();
+        event_dispatcher.notify();
 
         // ---DEBUG---
         // WaveDebugger(tracked_waves);
@@ -200,9 +553,6 @@ int main(int argc, const char** argv)
         // Display the resulting binary mask.
         // imshow ("Frame", binary_image);
 
-        // Write to output
-        // writer.write(binary_image);
-
         // User event: Exit loop with ESC.
         // char c = (char)waitKey(1);
         // if (c==27) {break;}
@@ -210,9 +560,20 @@ int main(int argc, const char** argv)
         ++frame_number;
     }
 
-    // Stop timer and write simple log to stdio.
+    // Stop timer, make sure the recognized waves are on disk, and write simple
+    // log to stdio.
     auto t2 = high_resolution_clock::now();
-    WriteLog(t1, t2, recognized_waves, number_of_frames);
+    if (wave_archive) {
+        long long unarchived = wave_archive->flush();
+        if (unarchived != 0)
+            std::cerr << unarchived << " recognized wave(s) could not be "
+                      << "written to " << archive_name << std::endl;
+    }
+    WriteLog(t1, t2, num_recognized_waves, number_of_frames,
+             wave_events.dropped());
+    WriteStageTimings(stages);
+    if (output != -1)
+        WriteBoxCost(box_mode, num_boxes, stages.total_milliseconds(output));
 
     // When main loop is complete, release video resource.
     cap.release();
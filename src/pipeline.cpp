@@ -0,0 +1,167 @@
+//
+//  file:       pipeline.cpp
+//
+//  project:    Multiple Wave Tracking
+//
+//  contents:   Definition of the task graph that runs the stages of the
+//              analysis of one frame.  Associated header file is
+//              pipeline.hpp.
+//
+//  use:        see readme.txt
+//
+
+#include "pipeline.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+
+// ---EXTERNAL LINKAGE---
+namespace pipeline {
+
+// Operation:
+//   Stops the helper threads, which are idle between runs.
+TaskGraph::~TaskGraph()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::vector<std::thread>::size_type i = 0; i != helpers_.size(); ++i)
+        helpers_[i].join();
+}
+
+// Args:
+//   name: name of the node, for reporting its timings
+//   task: the work of the node
+//   dependencies: ids of the nodes that must run before this one
+//   has_work: check of whether the task should run, or empty to always run it
+// Operation:
+//   Places the node one level below the deepest of its dependencies, and
+//   returns its id.
+int TaskGraph::add_node(const std::string& name,
+                        const std::function<void()>& task,
+                        const std::vector<int>& dependencies,
+                        const std::function<bool()>& has_work)
+{
+    int level = 0;
+    for (std::vector<int>::size_type i = 0; i != dependencies.size(); ++i)
+        level = std::max(level, nodes_[dependencies[i]].level + 1);
+
+    Node node = {name, task, has_work, level, 0, 0};
+    nodes_.push_back(node);
+    if (level == static_cast<int>(levels_.size()))
+        levels_.push_back(std::vector<int>());
+    levels_[level].push_back(size() - 1);
+    return size() - 1;
+}
+
+// Operation:
+//   Runs the levels of the graph in order.  The nodes of a level are checked
+//   for work first.  If at most one of them has any, it runs on the calling
+//   thread; otherwise they run concurrently, and the level ends when all of
+//   them have.
+void TaskGraph::run()
+{
+    for (std::vector<std::vector<int>>::size_type i = 0;
+         i != levels_.size(); ++i)
+    {
+        const std::vector<int>& level = levels_[i];
+        active_.clear();
+        for (std::vector<int>::size_type k = 0; k != level.size(); ++k)
+            if (check_node(level[k]))
+                active_.push_back(level[k]);
+
+        if (active_.size() == 1)
+            run_node(active_[0]);
+        else if (active_.size() > 1)
+            run_concurrently();
+    }
+    ++runs_;
+}
+
+// Args:
+//   node: id of a node
+// Operation:
+//   Calls the check of the node, if it has one, and records the time it took
+//   as the time of the node so far in this run.
+bool TaskGraph::check_node(int node)
+{
+    Node& checked = nodes_[node];
+    bool has_work = true;
+    checked.last_ms = 0;
+    if (checked.has_work)
+    {
+        auto begin = std::chrono::high_resolution_clock::now();
+        has_work = checked.has_work();
+        auto end = std::chrono::high_resolution_clock::now();
+        checked.last_ms =
+                std::chrono::duration<double, std::milli>(end - begin).count();
+    }
+    if (!has_work)
+        checked.total_ms += checked.last_ms;
+    return has_work;
+}
+
+// Args:
+//   node: id of a node
+// Operation:
+//   Runs the task of the node, and records the time it took.  Each node's
+//   timings are only written by the thread running it.
+void TaskGraph::run_node(int node)
+{
+    auto begin = std::chrono::high_resolution_clock::now();
+    nodes_[node].task();
+    auto end = std::chrono::high_resolution_clock::now();
+
+    nodes_[node].last_ms +=
+            std::chrono::duration<double, std::milli>(end - begin).count();
+    nodes_[node].total_ms += nodes_[node].last_ms;
+}
+
+// Operation:
+//   Hands all but the first active node to the helper threads, starting
+//   helpers if there are too few, then runs the first node on the calling
+//   thread and waits for the helpers to finish theirs.
+void TaskGraph::run_concurrently()
+{
+    while (helpers_.size() < active_.size() - 1)
+        helpers_.push_back(std::thread(&TaskGraph::help, this));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queued_.assign(active_.begin() + 1, active_.end());
+        unfinished_ = static_cast<int>(queued_.size());
+    }
+    wake_.notify_all();
+
+    run_node(active_[0]);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    finished_.wait(lock, [this] {return unfinished_ == 0;});
+}
+
+// Operation:
+//   Sleeps until nodes are queued, runs them one at a time, and wakes the
+//   calling thread once the last node of the level has finished.
+void TaskGraph::help()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+        wake_.wait(lock, [this] {return stopping_ || !queued_.empty();});
+        if (queued_.empty()) {break;}
+
+        int node = queued_.back();
+        queued_.pop_back();
+        lock.unlock();
+        run_node(node);
+        lock.lock();
+
+        if (--unfinished_ == 0)
+            finished_.notify_one();
+    }
+}
+
+}   // namespace pipeline
@@ -23,10 +23,6 @@
 // ---INTERNAL LINKAGE---
 namespace {
 
-// Resizing input constants:
-int kAnalysisWidth = 320;
-int kAnalysisHeight = 180;
-
 // Background Subtractor constants:
 const int kMogHistory = 300;
 const int kNumMixtures = 5;
@@ -0,0 +1,262 @@
+//
+//  file:       shared_state.cpp
+//
+//  project:    Multiple Wave Tracking
+//
+//  contents:   Definitions of the shared-memory snapshot publisher and reader.
+//              Associated header file is shared_state.hpp.
+//
+//  use:        see readme.txt
+//
+
+#include "shared_state.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+
+// ---INTERNAL LINKAGE---
+namespace {
+
+// Segment format constants.
+const char kStateMagic[8] = {'M', 'W', 'T', 'S', 'T', 'A', 'T', 'E'};
+const uint32_t kStateVersion = 2;
+
+// Attempts a reader makes at a consistent copy before giving up.
+const int kReadAttempts = 64;
+
+}   // namespace
+
+
+// ---EXTERNAL LINKAGE---
+namespace shared_state {
+
+// Layout of the shared-memory segment.  The header is written once by the
+// publisher; the sequence guards the snapshot.
+struct Segment {
+    char magic[sizeof(kStateMagic)];
+    uint32_t version;
+    int32_t publisher;
+    std::atomic<uint32_t> sequence;
+    Snapshot snapshot;
+};
+
+}   // namespace shared_state
+
+
+// ---INTERNAL LINKAGE---
+namespace {
+
+// Args:
+//   name: name of an existing shared-memory segment
+// Operation:
+//   Returns whether the segment was left by a publisher that no longer runs,
+//   which is known only if the segment has a valid header and its publisher's
+//   process does not exist.
+bool PublisherGone(const std::string& name)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1)
+        return false;
+
+    struct stat status;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &status) == 0 &&
+        static_cast<size_t>(status.st_size) >= sizeof(shared_state::Segment))
+        map = mmap(0, sizeof(shared_state::Segment), PROT_READ, MAP_SHARED,
+                   fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    const shared_state::Segment* segment =
+            static_cast<const shared_state::Segment*>(map);
+    bool gone = memcmp(segment->magic, kStateMagic, sizeof(kStateMagic)) == 0 &&
+                segment->version == kStateVersion &&
+                segment->publisher > 0 &&
+                kill(segment->publisher, 0) == -1 && errno == ESRCH;
+    munmap(map, sizeof(shared_state::Segment));
+    return gone;
+}
+
+}   // namespace
+
+
+namespace shared_state {
+
+//---STATE PUBLISHER---
+
+// Creates and maps a segment for publishing.
+//
+// Args:
+//   name: name of the shared-memory segment
+// Example:
+//   shared_state::StatePublisher publisher("/mwt_state");
+//   if (publisher.is_open()) {publisher.publish(frame_number, waves);}
+StatePublisher::StatePublisher(const std::string& name):
+    name_(name),
+    segment_(0),
+    in_use_(false)
+{
+    // Only ever publish to a segment of our own.  A segment that exists is
+    // removed only if the publisher that created it is gone; otherwise
+    // another tracker may be publishing to it.
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1 && errno == EEXIST)
+    {
+        if (!PublisherGone(name))
+        {
+            in_use_ = true;
+            return;
+        }
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        in_use_ = fd == -1 && errno == EEXIST;
+    }
+    if (fd == -1)
+        return;
+
+    void* map = MAP_FAILED;
+    if (ftruncate(fd, sizeof(Segment)) == 0)
+        map = mmap(0, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        shm_unlink(name.c_str());
+        return;
+    }
+    segment_ = static_cast<Segment*>(map);
+
+    // The new segment is zeroed, so its sequence starts even.  The header is
+    // written last, so a segment is only recognized once it is complete.
+    segment_->publisher = static_cast<int32_t>(getpid());
+    publish(0, std::vector<WaveState>());
+    memcpy(segment_->magic, kStateMagic, sizeof(kStateMagic));
+    segment_->version = kStateVersion;
+}
+
+// Operation:
+//   Unmaps the segment and removes its name, so that no new reader opens it.
+//   Readers that have it mapped keep the last snapshot.
+StatePublisher::~StatePublisher()
+{
+    if (segment_ == 0) {return;}
+
+    munmap(segment_, sizeof(Segment));
+    shm_unlink(name_.c_str());
+}
+
+// Args:
+//   frame_number: a frame number as an integer
+//   waves: a const reference to the states of the tracked waves
+// Operation:
+//   Makes the sequence odd, writes the snapshot in place, and makes the
+//   sequence even again.  The fences keep the writes of the snapshot between
+//   the two updates of the sequence.
+void StatePublisher::publish(int frame_number,
+                             const std::vector<WaveState>& waves)
+{
+    if (segment_ == 0) {return;}
+
+    uint32_t sequence = segment_->sequence.load(std::memory_order_relaxed);
+    segment_->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    Snapshot& snapshot = segment_->snapshot;
+    int num_waves = std::min(static_cast<int>(waves.size()),
+                             kMaxSnapshotWaves);
+    snapshot.frame = frame_number;
+    snapshot.num_tracked = static_cast<int32_t>(waves.size());
+    snapshot.num_waves = num_waves;
+    if (num_waves != 0)
+        memcpy(snapshot.waves, waves.data(), num_waves*sizeof(WaveState));
+
+    segment_->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+
+//---STATE READER---
+
+// Opens and maps a segment for reading.
+//
+// Args:
+//   name: name of the shared-memory segment
+// Example:
+//   shared_state::StateReader reader("/mwt_state");
+//   shared_state::Snapshot snapshot;
+//   if (reader.is_open() && reader.read(snapshot)) {snapshot.num_waves;}
+StateReader::StateReader(const std::string& name):
+    segment_(0)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1)
+        return;
+
+    struct stat status;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &status) == 0 &&
+        static_cast<size_t>(status.st_size) >= sizeof(Segment))
+        map = mmap(0, sizeof(Segment), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return;
+
+    const Segment* segment = static_cast<const Segment*>(map);
+    if (memcmp(segment->magic, kStateMagic, sizeof(kStateMagic)) != 0 ||
+        segment->version != kStateVersion)
+    {
+        munmap(map, sizeof(Segment));
+        return;
+    }
+    segment_ = segment;
+}
+
+// Operation:
+//   Unmaps the segment.
+StateReader::~StateReader()
+{
+    if (segment_ != 0)
+        munmap(const_cast<Segment*>(segment_), sizeof(Segment));
+}
+
+// Args:
+//   snapshot: a reference to hold the copy of the snapshot
+// Operation:
+//   Copies the snapshot while the sequence is even, and retries if the
+//   sequence changed during the copy.  Only the listed waves are copied.
+bool StateReader::read(Snapshot& snapshot) const
+{
+    if (segment_ == 0) {return false;}
+
+    for (int attempt = 0; attempt != kReadAttempts; ++attempt)
+    {
+        uint32_t before = segment_->sequence.load(std::memory_order_acquire);
+        if ((before & 1) == 0)
+        {
+            const Snapshot& shared = segment_->snapshot;
+            snapshot.frame = shared.frame;
+            snapshot.num_tracked = shared.num_tracked;
+            snapshot.num_waves = std::max(0, std::min(shared.num_waves,
+                                                      kMaxSnapshotWaves));
+            memcpy(snapshot.waves, shared.waves,
+                   snapshot.num_waves*sizeof(WaveState));
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (segment_->sequence.load(std::memory_order_relaxed) == before)
+                return true;
+        }
+        std::this_thread::yield();
+    }
+    return false;
+}
+
+}   // namespace shared_state
@@ -18,58 +18,110 @@
 
 #include "tracking.hpp"
 
+#include <algorithm>
+
+#include "events.hpp"
+
 
 // ---INTERNAL LINKAGE---
 namespace {
+
+// Band sums constant: automatic selection of the source of moments takes band
+// sums on frames whose search bands add up to at least this fraction of the
+// frame's area (See: TakeBandSums).  On analysis frames, building the band
+// sums was measured to cost as much as sweeping bands that add up to about
+// 1.2 frames, as the sweep reads each row once however many bands cover it.
+const double kMinBandSumsFraction = 1.25;
     
 // Args:
 //   a: const ref to a wave
 //   b: const ref to a different wave
 // Operation:
-//   Comparison function for sorting waves by descending birth.
-// TODO:
-//   This could be made a lambda in a std::sort().
-bool CompareAgeDesc(const wave_obj::Wave& a, const wave_obj::Wave& b)
+//   Strict ordering of waves from oldest to youngest.  Waves born in the same
+//   frame are ordered by name, which is assigned in order of construction.
+bool CompareAge(const wave_obj::Wave& a, const wave_obj::Wave& b)
 {
-    return a.birth_ >= b.birth_;
+    if (a.birth_ != b.birth_)
+        return a.birth_ < b.birth_;
+    return a.name_ < b.name_;
 }
 
 // Args:
-//   a: const ref to a wave
-//   b: const ref to a different wave
+//   a: const ref to a range
+//   b: const ref to a different range
 // Operation:
-//   Comparison function for sorting waves by ascending birth.
-// TODO:
-//   This could be made a lambda in a std::sort().
-bool CompareAgeAsc(const wave_obj::Wave& a, const wave_obj::Wave& b)
+//   Comparison function for sorting ranges by ascending start.
+bool CompareRangeStart(const cv::Range& a, const cv::Range& b)
 {
-    return a.birth_ <= b.birth_;
+    return a.start < b.start;
 }
-    
+
 // Args:
-//   wave: a const reference to a Wave object
-//   waves: a const reference to a vector of Wave objects
+//   range: const ref to a range
+//   intercept: a band intercept
 // Operation:
-//   Checks to see if the search regoin of interest of the input wave overlaps
-//   with the search ROI of any wave in the vector of waves.
-bool WillBeMerged(const wave_obj::Wave& wave,
-                  const std::vector<wave_obj::Wave>& waves)
+//   Comparison function for searching sorted, disjoint ranges for the first
+//   range that ends at or after an intercept.
+bool RangeEndsBefore(const cv::Range& range, int intercept)
 {
-    // Using the wave's center-of-mass y coordinate and major axis angle,
-    // find the wave's project on the y-axis.  Set to 'left_y'.
-    int delta_y_left = wave.centroid_.x *
-                       tan(wave.axis_angle_*3.14159265/180.0);
-    int left_y = wave.centroid_.y + delta_y_left;
-        
-    // For every wave in the vector of waves, check if left_y falls inside
-    // a wave's search ROI.  If yes, set return to true and break.
-    for (std::vector<wave_obj::Wave>::size_type i = 0; i != waves.size(); ++i)
+    return range.end < intercept;
+}
+
+// Args:
+//   intercept: a band intercept
+//   range: const ref to a range
+// Operation:
+//   Comparison function for searching sorted ranges for the first range that
+//   starts after an intercept.
+bool RangeStartsAfter(int intercept, const cv::Range& range)
+{
+    return intercept < range.start;
+}
+
+// Args:
+//   type: the kind of event
+//   wave: const ref to a wave
+//   frame_number: the frame of the event
+// Operation:
+//   Returns an event of the wave, holding a copy of its current state.
+events::WaveEvent WaveEventOf(events::EventType type,
+                              const wave_obj::Wave& wave, int frame_number)
+{
+    events::WaveEvent event = {type, wave.name_, frame_number,
+                               wave.centroid().x, wave.centroid().y,
+                               wave.mass(), wave.max_mass(),
+                               wave.max_displacement(), wave.recognized()};
+    return event;
+}
+
+// Args:
+//   waves: const ref to a pool of waves with updated search ROIs
+//   frame: const ref to a binary image
+//   source: the source of moments asked for
+// Operation:
+//   Returns whether to take the moments of the waves from band sums of the
+//   frame.  Automatic selection adds up the rows of each search band that
+//   lie within the intercepts of the frame, times the frame's width, which
+//   is about the area the sweep reads, and compares it to the frame's area,
+//   which the band sums read.
+bool TakeBandSums(const wave_obj::WavePool& waves, const cv::Mat& frame,
+                  tracking::MomentSource source)
+{
+    if (source != tracking::kAutoMoments)
+        return source == tracking::kBandSumMoments;
+    
+    int max_intercept = wave_obj::BandIntercept(frame.cols - 1,
+                                                frame.rows - 1) + 1;
+    double frame_area = static_cast<double>(frame.rows)*frame.cols;
+    double band_area = 0.0;
+    for (int i = 0; i != waves.size(); ++i)
     {
-        if (left_y >= waves[i].searchroi_coors_[0][0].y &&
-            left_y <= waves[i].searchroi_coors_[0][3].y)
-            return true;
+        cv::Range band = waves[i].search_band();
+        int rows = std::min(band.end, max_intercept) - std::max(band.start, 0);
+        if (rows > 0)
+            band_area += static_cast<double>(rows)*frame.cols;
     }
-    return false;
+    return band_area >= kMinBandSumsFraction*frame_area;
 }
 
 }  // namespace
@@ -79,134 +131,252 @@ bool WillBeMerged(const wave_obj::Wave& wave,
 namespace tracking {
 
 // Args:
-//   sections: a reference to a vector of Wave objects
+//   sections: a reference to a pool of Wave objects
+// Operation:
+//   Predicts where each wave will be in the next frame, and updates the ROI
+//   for finding its points in the frame around the prediction.
+void PredictSearchRegions(wave_obj::WavePool& sections)
+{
+    for (int i = 0; i != sections.size(); ++i)
+    {
+        sections[i].update_prediction();
+        sections[i].update_searchroi_coors();
+    }
+}
+
+// Args:
+//   sections: a reference to a pool of Wave objects
 //   frame: a const reference to a binary image
 //   frame_number: a frame number as an integer
 //   number_of_frames: number of frames in the video sequence as an integer
+//   buffers: storage reused from the previous frame
+//   options: whether waves keep their runs, and the source of their moments
+//   event_queue: a pointer to a queue for wave events, or null
 // Operation:
-//   Tracks a wave through a sequence of frames up calling all Wave member
-//   functions that begin with "update*".  Automatically "kills" waves if the
-//   analysis frame is the last frame in the sequence.
-void TrackWaves(std::vector<wave_obj::Wave>& sections, const cv::Mat& frame,
-                int frame_number, int number_of_frames)
+//   Tracks waves through a sequence of frames by finding their points in
+//   their predicted search ROIs in one pass over the frame (or looking up
+//   their moments in the frame's band sums, See: TakeBandSums), then
+//   updating the kinematics of all of them at once in the pool's table, and
+//   pushing a recognition event for each wave that became recognized.
+//   Automatically "kills" waves if the analysis frame is the last frame in
+//   the sequence.
+void TrackWaves(wave_obj::WavePool& sections, const cv::Mat& frame,
+                int frame_number, int number_of_frames,
+                TrackingBuffers& buffers, const TrackOptions& options,
+                events::EventQueue* event_queue)
 {
-    for (std::vector<wave_obj::Wave>::size_type i = 0; i != sections.size(); ++i)
+    // With no waves there is nothing to find, and nothing to update.
+    if (sections.empty()) {return;}
+    
+    if (!options.keep_runs &&
+        TakeBandSums(sections, frame, options.moment_source))
     {
-        // Update the ROI for finding wave's points in the frame.
-        sections[i].update_searchroi_coors();
+        // Sum the frame over band intercepts once, then look up the moments
+        // of each ROI in constant time.
+        buffers.sums.build(frame);
+        for (int i = 0; i != sections.size(); ++i)
+            sections[i].update_moments(buffers.sums);
+    }
+    else
+    {
+        // Find all the points in the ROIs in one pass over the frame,
+        // accumulating their moments.
+        wave_obj::UpdateAllPoints(sections, frame, buffers.sweep,
+                                  options.keep_runs);
+    }
+    
+    // Update death, center of mass, displacement, mass and recognition of
+    // every wave.  If we are in the last frame, we kill all the waves
+    // prematurely.
+    wave_obj::WaveTable& table = sections.table();
+    table.update(frame_number, frame_number == number_of_frames);
+    
+    if (event_queue != 0)
+    {
+        const std::vector<int>& recognized = table.recognized_rows();
+        for (std::vector<int>::size_type k = 0; k != recognized.size(); ++k)
+            event_queue->push(WaveEventOf(events::kRecognition,
+                                          sections[recognized[k]],
+                                          frame_number));
+    }
+}
 
-        // Find all the points in the ROI.
-        sections[i].update_points(frame);
-        
-        // Check if the wave is "dead" (i.e. no points found).
-        sections[i].update_death(frame_number);
-        
-        // If we are in the last frame, we kill all the waves prematurely.
-        if (frame_number == number_of_frames)
-            sections[i].death_ = frame_number;
-        
-        // Update the center of mass of the wave.
-        sections[i].update_centroid();
-        
-        // Update the bounding box of the wave for display purposes.
-        sections[i].update_boundingbox_coors();
-        
-        // Update instantaneous displacement of the wave, max displacement of
-        // the wave, and the deque of displacement history of the wave.
-        sections[i].update_displacement();
-        
-        // Update instantaneous mass of the wave, max mass of the wave.
-        sections[i].update_mass();
+// Args:
+//   tracked_waves: a reference to a pool of tracked waves
+//   recognized_waves: a reference to a vector of summaries of dead but
+//                     recognized waves
+//   event_queue: a pointer to a queue for wave events, or null
+// Operation:
+//   Checks to see if waves are dead and destroys them in tracked_waves if so,
+//   after appending the summaries of recognized waves to recognized_waves and
+//   pushing a death event for each.  Waves are visited from the last index
+//   down, so that destroying a wave only moves waves that have already been
+//   visited.
+void RemoveDeadWaves(wave_obj::WavePool& tracked_waves,
+                     std::vector<wave_obj::WaveSummary>& recognized_waves,
+                     events::EventQueue* event_queue)
+{
+    for (int i = tracked_waves.size() - 1; i >= 0; --i)
+    {
+        if (tracked_waves[i].death() == -1) {continue;}
         
-        // Check the wave dynamics to see if the wave has become "recognized".
-        // In this case we check max_mass and max_displacement.
-        sections[i].update_recognized();
-    }    
+        if (event_queue != 0)
+            event_queue->push(WaveEventOf(events::kDeath, tracked_waves[i],
+                                          tracked_waves[i].death()));
+        if (tracked_waves[i].recognized())
+            recognized_waves.push_back(tracked_waves[i].summarize());
+        tracked_waves.destroy(tracked_waves.handle(i));
+    }
 }
 
 // Args:
-//   tracked_waves: a reference to a vector of tracked waves
-//   recognized_waves: a reference to a vector of dead but recognized waves
+//   waves: a reference to a pool of waves
+//   buffers: storage reused from the previous frame
+//   event_queue: a pointer to a queue for wave events, or null
+//   frame_number: a frame number as an integer, for death events
 // Operation:
-//   Checks to see if waves are dead and removes them from tracked_waves if so.
-//   Moves recognized waves to recognized_waves, and destroys unrecognized
-//   waves.
-void RemoveDeadWaves(std::vector<wave_obj::Wave>& tracked_waves,
-                     std::vector<wave_obj::Wave>& recognized_waves)
+//   Destroys each wave whose band intercept falls inside the search band of
+//   an older wave (See: CompareAge).  Waves are visited from oldest to
+//   youngest, and each is looked up in an index of the bands of the waves
+//   visited before it, then added to it.  Duplicates are collected during the
+//   visit by handle, and a death event is pushed for each before they are
+//   destroyed.
+void RemoveDuplicateWaves(wave_obj::WavePool& waves, TrackingBuffers& buffers,
+                          events::EventQueue* event_queue, int frame_number)
 {
-    std::vector<wave_obj::Wave>::size_type i = 0;
+    // Visit the waves from oldest to youngest.
+    std::vector<int>& by_age = buffers.by_age;
+    by_age.resize(waves.size());
+    for (int i = 0; i != waves.size(); ++i)
+        by_age[i] = i;
+    std::sort(by_age.begin(), by_age.end(),
+              [&waves](int a, int b) {return CompareAge(waves[a], waves[b]);});
+    
+    BandIndex& older_bands = buffers.older_bands;
+    std::vector<wave_obj::WaveHandle>& duplicates = buffers.duplicates;
+    older_bands.clear();
+    duplicates.clear();
     
-    while (i != tracked_waves.size())
+    for (std::vector<int>::size_type k = 0; k != by_age.size(); ++k)
     {
-        if (tracked_waves[i].death_ != -1)
-        {
-            if (tracked_waves[i].recognized_ == true)
-                recognized_waves.push_back(tracked_waves[i]);
-            
-            tracked_waves.erase(tracked_waves.begin() + i);
-        } else {
-            ++i;
-        }
+        const wave_obj::Wave& wave = waves[by_age[k]];
+        if (older_bands.covers(wave_obj::BandIntercept(wave.centroid().x,
+                                                       wave.centroid().y)))
+            duplicates.push_back(waves.handle(by_age[k]));
+        older_bands.insert(wave.search_band());
+    }
+    
+    for (std::vector<wave_obj::WaveHandle>::size_type k = 0;
+         k != duplicates.size(); ++k)
+    {
+        if (event_queue != 0)
+            event_queue->push(WaveEventOf(events::kDeath,
+                                          *waves.get(duplicates[k]),
+                                          frame_number));
+        waves.destroy(duplicates[k]);
     }
 }
 
 // Args:
-//   waves: a reference to a vector of waves
+//   waves: a const reference to a pool of tracked waves
 // Operation:
-//   Checks each wave in the vector, starting with the oldest first, and
-//   destroys it if it is determined to be a duplicate of an existing wave in
-//   the vector.
-// TODO(@citrusvanilla):
-//   Double sort is probably unncessary here.
-void RemoveDuplicateWaves(std::vector<wave_obj::Wave>& waves)
+//   Replaces the index with the search bands of the waves.  The bands are
+//   sorted by start and merged into sorted, disjoint ranges of intercepts.
+void BandIndex::update(const wave_obj::WavePool& waves)
 {
-    // Sort waves by descending birth.
-    std::sort(waves.begin(), waves.end(), CompareAgeDesc);
+    bands_.clear();
+    for (int i = 0; i != waves.size(); ++i)
+        bands_.push_back(waves[i].search_band());
     
-    // Remove duplicates.
-    std::vector<wave_obj::Wave>::size_type i = 0;
-    std::vector<wave_obj::Wave>::size_type j = 0;
+    std::sort(bands_.begin(), bands_.end(), CompareRangeStart);
     
-    while (i != waves.size())
+    // Merge overlapping and adjacent bands.
+    claimed_.clear();
+    for (std::vector<cv::Range>::size_type i = 0; i != bands_.size(); ++i)
     {
-        int delta_y_left = waves[i].centroid_.x *
-                           tan(waves[i].axis_angle_*3.14159265/180.0);
-        int left_y = waves[i].centroid_.y + delta_y_left;
-        j = i+1;
-        
-        while (j != waves.size())
-        {
-            // check to see if waves[i] is in waves[j] shadow,
-            // and erase if it it is.
-            if (left_y >= waves[j].searchroi_coors_[0][0].y &&
-                left_y <= waves[j].searchroi_coors_[0][3].y)
-            {
-                waves.erase(waves.begin() + i);
-                break;
-            } else {
-                ++j;
-            }
-        }
-        if (j == waves.size()) {++i;}
+        if (!claimed_.empty() && bands_[i].start <= claimed_.back().end)
+            claimed_.back().end = std::max(claimed_.back().end, bands_[i].end);
+        else
+            claimed_.push_back(bands_[i]);
     }
-    // Resort the waves by ascending birth.
-    std::sort(waves.begin(), waves.end(), CompareAgeAsc);
-};
+}
 
 // Args:
-//   sections: a const reference to a vector of Wave objects
-//   tracked_waves: a reference to a vector of waves that are being tracked.
+//   band: a range of band intercepts [band.start, band.end)
 // Operation:
-//   Checks to see if each wave in sections may be a section of an existing wave
-//   in tracked_waves.  If so, we ignore it (to be destroyed later).  If it is
-//   a new wave, we add it to the list of waves to be tracked.
-void AddNewSectionsToTrackedWaves(const std::vector<wave_obj::Wave>& sections,
-                                  std::vector<wave_obj::Wave>& tracked_waves)
+//   Merges the band into the ranges it overlaps or adjoins, found by binary
+//   search, or inserts it in order if there are none.  Either way the ranges
+//   after it are shifted along the vector, in linear time.
+void BandIndex::insert(const cv::Range& band)
 {
-    for (std::vector<wave_obj::Wave>::size_type i = 0; i != sections.size(); ++i)
+    if (band.start >= band.end) {return;}
+    
+    std::vector<cv::Range>::iterator first =
+            std::lower_bound(claimed_.begin(), claimed_.end(), band.start,
+                             RangeEndsBefore);
+    std::vector<cv::Range>::iterator last =
+            std::upper_bound(first, claimed_.end(), band.end,
+                             RangeStartsAfter);
+    
+    if (first == last)
     {
-        if (!WillBeMerged(sections[i], tracked_waves))
-            tracked_waves.push_back(sections[i]);
+        claimed_.insert(first, band);
+        return;
+    }
+    first->start = std::min(first->start, band.start);
+    first->end = std::max((last - 1)->end, band.end);
+    claimed_.erase(first + 1, last);
+}
+
+// Args:
+//   intercept: a band intercept
+// Operation:
+//   Returns whether any band in the index covers the intercept, by binary
+//   search for the last range starting at or before it.
+bool BandIndex::covers(int intercept) const
+{
+    std::vector<cv::Range>::const_iterator after =
+            std::upper_bound(claimed_.begin(), claimed_.end(), intercept,
+                             RangeStartsAfter);
+    return after != claimed_.begin() && (after - 1)->end > intercept;
+}
+
+// Operation:
+//   Empties the index, keeping its storage.
+void BandIndex::clear()
+{
+    bands_.clear();
+    claimed_.clear();
+}
+
+// Args:
+//   sections: a const reference to a vector of Section records
+//   tracked_waves: a reference to a pool of waves that are being tracked.
+//   index: a reference to the band index of tracked_waves
+//   event_queue: a pointer to a queue for wave events, or null
+// Operation:
+//   Checks to see if each section may be a section of an existing wave in
+//   tracked_waves by looking up its band intercept in the index.  If so, we
+//   ignore it.  If it is a new wave, we promote it to a Wave object in the
+//   pool of waves to be tracked, add its search band to the index, and push a
+//   birth event for it.
+void AddNewSectionsToTrackedWaves(
+        const std::vector<wave_obj::Section>& sections,
+        wave_obj::WavePool& tracked_waves,
+        BandIndex& index,
+        events::EventQueue* event_queue)
+{
+    for (std::vector<wave_obj::Section>::size_type i = 0; i != sections.size();
+         ++i)
+    {
+        if (index.covers(sections[i].band_intercept)) {continue;}
+        
+        wave_obj::WaveHandle handle = tracked_waves.create(sections[i]);
+        const wave_obj::Wave& wave = *tracked_waves.get(handle);
+        index.insert(wave.search_band());
+        if (event_queue != 0)
+            event_queue->push(WaveEventOf(events::kBirth, wave,
+                                          wave.birth_));
     }
 }
 
@@ -15,6 +15,8 @@
 
 #include "wave_objects.hpp"
 
+#include "preprocessing.hpp"
+
 
 // ---INTERNAL LINKAGE---
 namespace {
@@ -23,10 +25,296 @@ namespace {
 const int kDisplacementThreshold = 10;
 const int kMassThreshold = 1000;
 const int kSearchRegionBuffer = 15;
-const int kAnalysisFrameWidth = 320;
-const int kAnalysisFrameHeight = 180;
+const int kMinSearchRegionBuffer = 5;
 const double kWaveAngle = 5.0;
-const int kTrackingHistory = 20;
+
+// Motion prediction constants: number of recent centroids the velocity is
+// fit to, and the number of standard deviations of the wave's spread and of
+// the prediction error that the search band covers.
+const int kVelocityWindow = 5;
+const double kSpreadSigmas = 2.5;
+const double kPredictionSigmas = 3.0;
+
+// Parallel tracking constant: frames of preprocessing::kMinParallelArea or
+// more are scanned in horizontal stripes of at least kMinStripeRows rows on
+// OpenCV's thread pool.
+const int kMinStripeRows = 32;
+
+// Slope of the wave axis, used to project points onto the y-axis.
+const double kWaveSlope = std::tan(kWaveAngle*3.14159265/180.0);
+
+// Args:
+//   offset: a band intercept offset from the start of a row
+//   width: width of the row
+// Operation:
+//   Returns the first column x in [0, width] whose band intercept is at least
+//   offset above that of column 0, or width if there is none.
+int FirstColumnAtOffset(int offset, int width)
+{
+    if (offset <= 0)
+        return 0;
+    
+    // Estimate the column in closed form, then correct for rounding.
+    double estimate = std::ceil(offset / kWaveSlope);
+    int x = estimate < width ? static_cast<int>(estimate) : width;
+    while (x > 0 && static_cast<int>((x - 1)*kWaveSlope) >= offset) {--x;}
+    while (x < width && static_cast<int>(x*kWaveSlope) < offset) {++x;}
+    return x;
+}
+
+// Args:
+//   a, b: band sweeps
+// Operation:
+//   Orders band sweeps by the start of their bands.
+bool CompareBandStart(const wave_obj::BandSweep& a,
+                      const wave_obj::BandSweep& b)
+{
+    return a.band.start < b.band.start;
+}
+
+// Args:
+//   a, b: pixel runs on the same row
+// Operation:
+//   Orders runs by their end, for finding the first run past a column.
+bool CompareRunEnd(const wave_obj::PixelRun& a, const wave_obj::PixelRun& b)
+{
+    return a.x_end < b.x_end;
+}
+
+// Args:
+//   row: pointer to the pixels of row y
+//   y: the row
+//   span: the columns to scan
+//   runs: a reference to a vector that the foreground runs are appended to
+// Operation:
+//   Appends the runs of foreground pixels of the row inside span, in order.
+void FindRowRuns(const uchar* row, int y, const cv::Range& span,
+                 std::vector<wave_obj::PixelRun>& runs)
+{
+    int x = span.start;
+    
+    while (x != span.end)
+    {
+        // Skip background, then find the end of the foreground run.
+        if (row[x] == 0) {++x; continue;}
+        
+        wave_obj::PixelRun run;
+        run.y = y;
+        run.x_begin = x;
+        while (x != span.end && row[x] != 0) {++x;}
+        run.x_end = x;
+        runs.push_back(run);
+    }
+}
+
+// Args:
+//   frame: the binary image of the current frame
+// Operation:
+//   Returns the number of horizontal stripes to scan the frame in.  Small
+//   frames are scanned in one stripe, on the calling thread.
+int NumStripes(const cv::Mat& frame)
+{
+    if (frame.rows*frame.cols < preprocessing::kMinParallelArea)
+        return 1;
+    return std::max(1, std::min(cv::getNumThreads(),
+                                frame.rows / kMinStripeRows));
+}
+
+// Args:
+//   frame: the binary image of the current frame
+//   row_begin: first row to bin
+//   row_end: row past the last row to bin
+//   segment_begin: first column of each intercept offset, plus the width
+//   bins: pointer to the bins of the intercepts, offset by one
+// Operation:
+//   Sums the moments of each row's segments of equal intercept offset into
+//   the bins of their intercepts.
+void BinRows(const cv::Mat& frame, int row_begin, int row_end,
+             const std::vector<int>& segment_begin,
+             wave_obj::PixelMoments* bins)
+{
+    int num_offsets = static_cast<int>(segment_begin.size()) - 1;
+    
+    for (int y = row_begin; y < row_end; ++y)
+    {
+        const uchar* row = frame.ptr<uchar>(y);
+        
+        for (int offset = 0; offset < num_offsets; ++offset)
+        {
+            long long count = 0;
+            long long sum_x = 0;
+            long long sum_xx = 0;
+            for (int x = segment_begin[offset]; x < segment_begin[offset + 1];
+                 ++x)
+            {
+                long long is_set = row[x] != 0;
+                count += is_set;
+                sum_x += is_set*x;
+                sum_xx += is_set*x*x;
+            }
+            
+            wave_obj::PixelMoments& bin = bins[y + offset + 1];
+            bin.m00 += count;
+            bin.m10 += sum_x;
+            bin.m01 += count*y;
+            bin.m20 += sum_xx;
+            bin.m11 += sum_x*y;
+            bin.m02 += count*y*y;
+        }
+    }
+}
+
+// Bins each horizontal stripe in a range of stripes, each into its own bins.
+// Stripes share no output, so OpenCV may run the range on as many threads as
+// it likes.
+class StripeBinner : public cv::ParallelLoopBody {
+  public:
+    StripeBinner(const cv::Mat& frame, const std::vector<int>& segment_begin,
+                 std::vector<std::vector<wave_obj::PixelMoments> >& bins):
+        frame_(frame), segment_begin_(segment_begin), bins_(bins) {}
+    
+    void operator()(const cv::Range& range) const
+    {
+        int num_stripes = static_cast<int>(bins_.size());
+        for (int s = range.start; s != range.end; ++s)
+            BinRows(frame_, frame_.rows*s / num_stripes,
+                    frame_.rows*(s + 1) / num_stripes, segment_begin_,
+                    bins_[s].data());
+    }
+    
+  private:
+    const cv::Mat& frame_;
+    const std::vector<int>& segment_begin_;
+    std::vector<std::vector<wave_obj::PixelMoments> >& bins_;
+};
+
+// Args:
+//   sweeps: search bands sorted by start
+//   frame: the binary image of the current frame
+//   stripe: the stripe of rows to sweep, with its outputs and buffers
+// Operation:
+//   Sweeps the bands down the rows.  On each row, the runs of foreground
+//   inside the union of the active bands' spans are found once, and each
+//   active wave accumulates the parts of those runs inside its own span.
+void SweepBands(const std::vector<wave_obj::BandSweep>& sweeps,
+                const cv::Mat& frame, wave_obj::SweepStripe& stripe)
+{
+    const std::vector<wave_obj::PixelMoments*>& moments = stripe.moments_out;
+    const std::vector<std::vector<wave_obj::PixelRun>*>& runs =
+            stripe.runs_out;
+    std::vector<wave_obj::BandSweep>& active = stripe.active;
+    std::vector<cv::Range>& spans = stripe.spans;
+    std::vector<wave_obj::PixelRun>& row_runs = stripe.row_runs;
+    std::vector<wave_obj::BandSweep>::size_type next = 0;
+    active.clear();
+    
+    for (int y = stripe.row_begin; y < stripe.row_end; ++y)
+    {
+        // Activate bands that begin by this row, and retire bands that have
+        // ended.  Bands activate in order of start, and stay in that order.
+        while (next != sweeps.size() && sweeps[next].row_begin <= y)
+            active.push_back(sweeps[next++]);
+        
+        std::vector<wave_obj::BandSweep>::size_type kept = 0;
+        for (std::vector<wave_obj::BandSweep>::size_type k = 0;
+             k != active.size(); ++k)
+            if (active[k].row_end > y) {active[kept++] = active[k];}
+        active.resize(kept);
+        
+        if (active.empty())
+        {
+            // Skip ahead to the next band, if there is one.
+            if (next == sweeps.size()) {break;}
+            y = sweeps[next].row_begin - 1;
+            continue;
+        }
+        
+        // Find the runs of the row inside the union of the active spans.
+        const uchar* row = frame.ptr<uchar>(y);
+        spans.clear();
+        row_runs.clear();
+        cv::Range merged(0, 0);
+        
+        for (std::vector<wave_obj::BandSweep>::size_type k = 0;
+             k != active.size(); ++k)
+        {
+            cv::Range span = wave_obj::BandRowSpan(y, active[k].band,
+                                                   frame.cols);
+            spans.push_back(span);
+            if (span.start >= span.end) {continue;}
+            
+            if (span.start > merged.end)
+            {
+                FindRowRuns(row, y, merged, row_runs);
+                merged = span;
+            }
+            else
+                merged.end = std::max(merged.end, span.end);
+        }
+        FindRowRuns(row, y, merged, row_runs);
+        
+        // Split the runs among the active waves.
+        for (std::vector<wave_obj::BandSweep>::size_type k = 0;
+             k != active.size(); ++k)
+        {
+            int wave = active[k].wave;
+            const cv::Range& span = spans[k];
+            
+            wave_obj::PixelRun bound;
+            bound.x_end = span.start;
+            std::vector<wave_obj::PixelRun>::const_iterator it =
+                    std::upper_bound(row_runs.begin(), row_runs.end(), bound,
+                                     CompareRunEnd);
+            
+            for (; it != row_runs.end() && it->x_begin < span.end; ++it)
+            {
+                wave_obj::PixelRun run;
+                run.y = y;
+                run.x_begin = std::max(it->x_begin, span.start);
+                run.x_end = std::min(it->x_end, span.end);
+                
+                moments[wave]->add_run(run.y, run.x_begin, run.x_end);
+                if (!runs.empty())
+                    runs[wave]->push_back(run);
+            }
+        }
+    }
+}
+
+// Sweeps each stripe in a range of stripes.  Stripes share no output, so
+// OpenCV may run the range on as many threads as it likes.
+class StripeSweeper : public cv::ParallelLoopBody {
+  public:
+    StripeSweeper(const std::vector<wave_obj::BandSweep>& sweeps,
+                  const cv::Mat& frame,
+                  std::vector<wave_obj::SweepStripe>& stripes):
+        sweeps_(sweeps), frame_(frame), stripes_(stripes) {}
+    
+    void operator()(const cv::Range& range) const
+    {
+        for (int s = range.start; s != range.end; ++s)
+            SweepBands(sweeps_, frame_, stripes_[s]);
+    }
+    
+  private:
+    const std::vector<wave_obj::BandSweep>& sweeps_;
+    const cv::Mat& frame_;
+    std::vector<wave_obj::SweepStripe>& stripes_;
+};
+
+// Args:
+//   column: a column of a table
+//   row: a row of the column
+// Operation:
+//   Moves the last value of the column into the row, unless the row is the
+//   last, and drops the last row.
+template <typename T>
+void MoveLastInto(std::vector<T>& column, int row)
+{
+    if (row + 1 != static_cast<int>(column.size()))
+        column[row] = std::move(column.back());
+    column.pop_back();
+}
 
 }   // namespace
 
@@ -34,44 +322,316 @@ const int kTrackingHistory = 20;
 // ---EXTERNAL LINKAGE---
 namespace wave_obj {
 
-// Object that represents a wave in a video frame.  Initiated from a
-// filtered contour object (See: 'detection.cpp').
+// Accumulates the moments of a run of pixels.  The sums of x and of x^2 over
+// the run are evaluated in closed form.
 //
 // Args:
-//   contour: must be initialized with an opencv contour
-//   frame_number: must be initialized with a frame number
+//   y: row of the run
+//   x_begin: first column of the run
+//   x_end: one past the last column of the run
 // Example:
-//   std::vector<wave_obj::Wave> vector_of_waves;
-//   wave_obj::Wave one_wave(contour, frame_number);
-//   vector_of_waves.push_back(one_wave);
-Wave::Wave(std::vector<cv::Point> contour, int frame_number):
+//   wave_obj::PixelMoments moms = {};
+//   moms.add_run(run.y, run.x_begin, run.x_end);
+void PixelMoments::add_run(int y, int x_begin, int x_end)
+{
+    long long n = x_end - x_begin;
+    long long first = x_begin;
+    long long last = x_end - 1;
+    long long sum_x = (first + last)*n / 2;
+    long long sum_xx = (last*(last + 1)*(2*last + 1) -
+                        (first - 1)*first*(2*first - 1)) / 6;
+    
+    m00 += n;
+    m10 += sum_x;
+    m01 += n*y;
+    m20 += sum_xx;
+    m11 += sum_x*y;
+    m02 += n*y*y;
+}
+
+// Adds the moments of another set of pixels.
+//
+// Args:
+//   other: moments of a disjoint set of pixels
+void PixelMoments::add(const PixelMoments& other)
+{
+    m00 += other.m00;
+    m10 += other.m10;
+    m01 += other.m01;
+    m20 += other.m20;
+    m11 += other.m11;
+    m02 += other.m02;
+}
+
+// Projects a point onto the y-axis along the wave angle.
+//
+// Args:
+//   x: x coordinate of a point
+//   y: y coordinate of a point
+// Example:
+//   int left_y = wave_obj::BandIntercept(centroid.x, centroid.y);
+int BandIntercept(int x, int y)
+{
+    int delta_y_left = x*kWaveSlope;
+    return y + delta_y_left;
+}
+
+// Finds the columns of a row that lie inside a band of intercepts.
+//
+// Args:
+//   y: the row
+//   band: a range of band intercepts [band.start, band.end)
+//   width: width of the row
+// Example:
+//   cv::Range span = wave_obj::BandRowSpan(y, band, frame.cols);
+//   for (int x = span.start; x < span.end; ++x) {...}
+cv::Range BandRowSpan(int y, const cv::Range& band, int width)
+{
+    int x_begin = FirstColumnAtOffset(band.start - y, width);
+    int x_end = FirstColumnAtOffset(band.end - y, width);
+    return cv::Range(x_begin, std::max(x_begin, x_end));
+}
+
+// Sums the moments of a frame's foreground over band intercepts.
+//
+// Args:
+//   frame: the binary image of the current frame
+// Example:
+//   wave_obj::BandSums sums;
+//   sums.build(frame);
+//   wave_obj::PixelMoments moms = sums.band_moments(band);
+void BandSums::build(const cv::Mat& frame)
+{
+    // Columns of a row with the same intercept offset are contiguous, and
+    // only depend on the width of the frame.
+    if (frame.cols != width_)
+    {
+        width_ = frame.cols;
+        int max_offset = width_ > 0 ? BandIntercept(width_ - 1, 0) : 0;
+        segment_begin_.resize(max_offset + 2);
+        for (int offset = 0; offset <= max_offset + 1; ++offset)
+            segment_begin_[offset] = FirstColumnAtOffset(offset, width_);
+        segment_begin_[max_offset + 1] = width_;
+    }
+    
+    int num_offsets = static_cast<int>(segment_begin_.size()) - 1;
+    prefix_.assign(frame.rows + num_offsets + 1, PixelMoments());
+    
+    // Sum the moments of each row's segments into the bins of their
+    // intercepts, offset by one for the prefix sum below.  Large frames are
+    // binned in stripes on the thread pool, each stripe into its own bins,
+    // and the bins are added in stripe order.  Sums are integers, so the
+    // result is the same however the frame is split.
+    int num_stripes = NumStripes(frame);
+    if (num_stripes == 1)
+    {
+        BinRows(frame, 0, frame.rows, segment_begin_, prefix_.data());
+    } else {
+        stripe_bins_.resize(num_stripes);
+        for (int t = 0; t != num_stripes; ++t)
+            stripe_bins_[t].assign(prefix_.size(), PixelMoments());
+        cv::parallel_for_(cv::Range(0, num_stripes),
+                          StripeBinner(frame, segment_begin_, stripe_bins_));
+        
+        for (int t = 0; t != num_stripes; ++t)
+            for (std::vector<PixelMoments>::size_type i = 0;
+                 i != prefix_.size(); ++i)
+                prefix_[i].add(stripe_bins_[t][i]);
+    }
+    
+    for (std::vector<PixelMoments>::size_type i = 1; i < prefix_.size(); ++i)
+        prefix_[i].add(prefix_[i - 1]);
+}
+
+// Looks up the moments of the foreground inside a band.
+//
+// Args:
+//   band: a range of band intercepts [band.start, band.end)
+// Example:
+//   wave_obj::PixelMoments moms = sums.band_moments(wave.search_band());
+PixelMoments BandSums::band_moments(const cv::Range& band) const
+{
+    int last = static_cast<int>(prefix_.size()) - 1;
+    int lo = std::min(std::max(band.start, 0), last);
+    int hi = std::min(std::max(band.end, lo), last);
+    
+    PixelMoments moments;
+    moments.m00 = prefix_[hi].m00 - prefix_[lo].m00;
+    moments.m10 = prefix_[hi].m10 - prefix_[lo].m10;
+    moments.m01 = prefix_[hi].m01 - prefix_[lo].m01;
+    moments.m20 = prefix_[hi].m20 - prefix_[lo].m20;
+    moments.m11 = prefix_[hi].m11 - prefix_[lo].m11;
+    moments.m02 = prefix_[hi].m02 - prefix_[lo].m02;
+    return moments;
+}
+
+//---WAVE TABLE---
+
+// Args:
+//   section: a detected section
+// Operation:
+//   Appends a row with the state of a wave at birth: its centroid, the major
+//   axis through it in standard form (Ax + By = C), and its mass, with no
+//   displacement.  Returns the row.
+int WaveTable::append(const Section& section)
+{
+    double a = std::tan(-kWaveAngle*3.14159265/180.0);
+    cv::Point centroid(section.centroid_x, section.centroid_y);
+    
+    moments_.push_back(PixelMoments());
+    axis_a_.push_back(a);
+    axis_b_.push_back(-1);
+    axis_c_.push_back(centroid.y - a*centroid.x);
+    centroid_x_.push_back(centroid.x);
+    centroid_y_.push_back(centroid.y);
+    centroid_history_.push_back(RingBuffer<cv::Point, kTrackingHistory>());
+    centroid_history_.back().push_back(centroid);
+    displacement_.push_back(0);
+    max_displacement_.push_back(0);
+    displacement_history_.push_back(RingBuffer<int, kTrackingHistory>());
+    mass_.push_back(static_cast<int>(section.m00));
+    max_mass_.push_back(static_cast<int>(section.m00));
+    death_.push_back(-1);
+    recognized_.push_back(0);
+    return size() - 1;
+}
+
+// Args:
+//   row: a row of the table
+// Operation:
+//   Moves the last row into the row, in every column.
+void WaveTable::remove(int row)
+{
+    MoveLastInto(moments_, row);
+    MoveLastInto(axis_a_, row);
+    MoveLastInto(axis_b_, row);
+    MoveLastInto(axis_c_, row);
+    MoveLastInto(centroid_x_, row);
+    MoveLastInto(centroid_y_, row);
+    MoveLastInto(centroid_history_, row);
+    MoveLastInto(displacement_, row);
+    MoveLastInto(max_displacement_, row);
+    MoveLastInto(displacement_history_, row);
+    MoveLastInto(mass_, row);
+    MoveLastInto(max_mass_, row);
+    MoveLastInto(death_, row);
+    MoveLastInto(recognized_, row);
+}
+
+// Args:
+//   frame_number: a frame number as an integer
+//   kill_all: whether every wave dies in this frame
+// Operation:
+//   Updates mass and death, centroid, displacement and recognition of every
+//   row from its moments, one column at a time, and records the rows that
+//   became recognized.
+void WaveTable::update(int frame_number, bool kill_all)
+{
+    int rows = size();
+    
+    for (int i = 0; i != rows; ++i)
+    {
+        mass_[i] = static_cast<int>(moments_[i].m00);
+        if (mass_[i] > max_mass_[i])
+            max_mass_[i] = mass_[i];
+        if (mass_[i] == 0 || kill_all)
+            death_[i] = frame_number;
+    }
+    
+    for (int i = 0; i != rows; ++i)
+    {
+        if (moments_[i].m00 != 0)
+        {
+            centroid_x_[i] = int(moments_[i].m10 / moments_[i].m00);
+            centroid_y_[i] = int(moments_[i].m01 / moments_[i].m00);
+        } else {
+            centroid_x_[i] = -1;
+            centroid_y_[i] = -1;
+        }
+        
+        // Discards the oldest centroid if the history is full.
+        centroid_history_[i].push_back(cv::Point(centroid_x_[i],
+                                                 centroid_y_[i]));
+    }
+    
+    for (int i = 0; i != rows; ++i)
+    {
+        // A wave with no centroid keeps its last displacement.
+        if (centroid_x_[i] > -1 && centroid_y_[i] > -1)
+        {
+            displacement_[i] = std::abs(axis_a_[i]*centroid_x_[i] +
+                                        axis_b_[i]*centroid_y_[i] +
+                                        axis_c_[i]) /
+                               (std::sqrt(axis_a_[i]*axis_a_[i] +
+                                          axis_b_[i]*axis_b_[i]));
+        }
+        if (displacement_[i] > max_displacement_[i])
+            max_displacement_[i] = displacement_[i];
+        displacement_history_[i].push_back(displacement_[i]);
+    }
+    
+    recognized_rows_.clear();
+    for (int i = 0; i != rows; ++i)
+    {
+        if (recognized_[i] ||
+            max_displacement_[i] < kDisplacementThreshold ||
+            max_mass_[i] < kMassThreshold)
+            continue;
+        recognized_[i] = 1;
+        recognized_rows_.push_back(i);
+    }
+}
+
+
+//---WAVE---
+
+// Object that represents a wave in a video frame.  Promoted from a section
+// that is not part of any tracked wave (See: 'tracking.cpp').
+//
+// Args:
+//   section: must be initialized with a detected section
+//   table: the table of the wave's pool
+//   row: the row of the table appended for the section
+// Example:
+//   wave_obj::WavePool pool;
+//   wave_obj::WaveHandle handle = pool.create(section);
+Wave::Wave(const Section& section, WaveTable* table, int row):
     name_(),
-    points_(contour),
-    birth_(frame_number),
+    birth_(section.birth),
     axis_angle_(kWaveAngle),
-    centroid_(),
-    centroid_vec_(),
-    original_axis_(),
     searchroi_coors_(),
+    velocity_(0.0),
+    search_buffer_(kSearchRegionBuffer),
+    runs_(),
+    table_(table),
+    row_(row),
     boundingbox_coors_(),
-    displacement_(0),
-    max_displacement_(0),
-    displacement_vec_(),
-    mass_(),
-    max_mass_(),
-    recognized_(false),
-    death_(-1)
+    has_boundingbox_(false),
+    boundingbox_stale_(true),
+    boundingbox_mode_(kExactBox)
 {
     set_wave_name();
-    update_centroid();
-    set_original_axis();
     update_searchroi_coors();
-    update_boundingbox_coors();
-    update_mass();
 };
 
 
-//---METHODS (10)---
+//---METHODS (9)---
+
+// Args:
+//   section: a detected section
+//   table: the table of the wave's pool
+//   row: the row of the table appended for the section
+// Operation:
+//   Replaces the wave with a newly constructed one, then restores the storage
+//   of its runs, emptied.
+void Wave::reset(const Section& section, WaveTable* table, int row)
+{
+    std::vector<PixelRun> runs;
+    runs.swap(runs_);
+    *this = Wave(section, table, row);
+    runs.clear();
+    runs_.swap(runs);
+}
 
 // Operation:
 //   Sets the name of the wave using an incremented static int var.
@@ -83,200 +643,440 @@ void Wave::set_wave_name()
 }
 
 // Operation:
-//   Sets the major axis of the wave from its origin in standard form.
-void Wave::set_original_axis()
+//   Updates velocity_ by a least-squares fit of band intercept over time to
+//   the last kVelocityWindow centroids, and search_buffer_ from the spread of
+//   the wave's pixels across its axis and the error of the fit.
+void Wave::update_prediction()
 {
-    original_axis_[0] = std::tan(-axis_angle_*3.14159265/180.0);
-    original_axis_[1] = -1;
-    original_axis_[2] = (centroid_.y -
-                         std::tan(-axis_angle_*3.14159265/180.0)*centroid_.x);
+    const RingBuffer<cv::Point, kTrackingHistory>& history =
+            table_->centroid_history_[row_];
+    const PixelMoments& moments = table_->moments_[row_];
+    int n = std::min(history.size(), kVelocityWindow);
+    
+    // Too little history, or no pixels to measure the spread from.
+    if (n < 3 || moments.m00 == 0)
+    {
+        velocity_ = 0.0;
+        search_buffer_ = kSearchRegionBuffer;
+        return;
+    }
+    
+    // Fit intercept = a + velocity*t over t = 0..n-1.
+    double mean_t = 0.5*(n - 1);
+    double mean_b = 0.0;
+    for (int t = 0; t < n; ++t)
+    {
+        const cv::Point& c = history[history.size() - n + t];
+        mean_b += BandIntercept(c.x, c.y);
+    }
+    mean_b /= n;
+    
+    double s_tt = 0.0;
+    double s_tb = 0.0;
+    for (int t = 0; t < n; ++t)
+    {
+        const cv::Point& c = history[history.size() - n + t];
+        s_tt += (t - mean_t)*(t - mean_t);
+        s_tb += (t - mean_t)*(BandIntercept(c.x, c.y) - mean_b);
+    }
+    velocity_ = s_tb / s_tt;
+    
+    // Standard error of predicting the next intercept, at t = n.
+    double s_rr = 0.0;
+    for (int t = 0; t < n; ++t)
+    {
+        const cv::Point& c = history[history.size() - n + t];
+        double r = BandIntercept(c.x, c.y) -
+                   (mean_b + velocity_*(t - mean_t));
+        s_rr += r*r;
+    }
+    double prediction_sd = std::sqrt(s_rr / (n - 2) *
+                                     (1.0 + 1.0 / n +
+                                      (n - mean_t)*(n - mean_t) / s_tt));
+    
+    // Spread of the wave's pixels across its axis, from the variance of their
+    // band intercepts.
+    double m00 = static_cast<double>(moments.m00);
+    double mean_x = moments.m10 / m00;
+    double mean_y = moments.m01 / m00;
+    double var_x = moments.m20 / m00 - mean_x*mean_x;
+    double cov_xy = moments.m11 / m00 - mean_x*mean_y;
+    double var_y = moments.m02 / m00 - mean_y*mean_y;
+    double spread_sd = std::sqrt(std::max(var_y + 2*kWaveSlope*cov_xy +
+                                          kWaveSlope*kWaveSlope*var_x, 0.0));
+    
+    int buffer = static_cast<int>(std::ceil(kSpreadSigmas*spread_sd +
+                                            kPredictionSigmas*prediction_sd));
+    search_buffer_ = std::min(std::max(buffer, kMinSearchRegionBuffer),
+                              kSearchRegionBuffer);
 }
 
 // Operation:
 //   Sets the four coordinates of the search ROI.
 void Wave::update_searchroi_coors()
 {
-    searchroi_coors_.clear();
+    // Moving along the direction of travel shifts the band intercept, which
+    // is the same as shifting the centroid vertically.
+    cv::Point predicted(centroid());
+    predicted.y += static_cast<int>(std::floor(velocity_ + 0.5));
     
     // Get the left and right y-axis buffer region deltas.
-    int delta_y_left = centroid_.x*std::tan(axis_angle_*3.14159265/180.0);
-    int delta_y_right = (kAnalysisFrameWidth - centroid_.x) *
+    int delta_y_left = predicted.x*std::tan(axis_angle_*3.14159265/180.0);
+    int delta_y_right = (preprocessing::kAnalysisWidth - predicted.x) *
                          std::tan(axis_angle_*3.14159265/180.0);
     
     // These coordinates MUST be in order!
-    cv::Point upper_left(0,int(centroid_.y + delta_y_left -
-                               kSearchRegionBuffer));
-    cv::Point upper_right(kAnalysisFrameWidth, int(centroid_.y - delta_y_right -
-                                                   kSearchRegionBuffer));
-    cv::Point lower_right(kAnalysisFrameWidth, int(centroid_.y - delta_y_right +
-                                                   kSearchRegionBuffer));
-    cv::Point lower_left(0, int(centroid_.y + delta_y_left +
-                                kSearchRegionBuffer));
-
-    // Push all the points into one vector representing the polygon of the ROI.
-    std::vector<cv::Point> ROI = {upper_left, upper_right, lower_right,
-                                  lower_left};
-
-    // Update the search region coordinates.
-    searchroi_coors_.push_back(ROI);
+    searchroi_coors_[0] = cv::Point(0, int(predicted.y + delta_y_left -
+                                           search_buffer_));
+    searchroi_coors_[1] = cv::Point(preprocessing::kAnalysisWidth,
+                                    int(predicted.y - delta_y_right -
+                                        search_buffer_));
+    searchroi_coors_[2] = cv::Point(preprocessing::kAnalysisWidth,
+                                    int(predicted.y - delta_y_right +
+                                        search_buffer_));
+    searchroi_coors_[3] = cv::Point(0, int(predicted.y + delta_y_left +
+                                           search_buffer_));
 }
 
 // Operation:
-//   Sets the death to the current frame if the wave as disappeared from a frame.
-void Wave::update_death(int frame_number)
+//   Returns the range of intercepts between the upper-left and lower-left
+//   corners of the search ROI, inclusive.
+cv::Range Wave::search_band() const
 {
-    if (points_.empty())
-        death_ = frame_number;
+    return cv::Range(searchroi_coors_[0].y, searchroi_coors_[3].y + 1);
 }
 
+// Args:
+//   sums: band sums of the current frame
 // Operation:
-//   Updates points by masking input frame and measuring representaiton.
-void Wave::update_points(const cv::Mat& frame)
+//   Sets moments from the band sums over the search band, and clears runs.
+void Wave::update_moments(const BandSums& sums)
 {
-    points_.clear();
-    
-    // Init empty images to hold our points, and the mask
-    cv::Mat points_img = cv::Mat::zeros(kAnalysisFrameHeight,
-                                        kAnalysisFrameWidth, CV_8UC1);
-    cv::Mat mask_img = cv::Mat::zeros(kAnalysisFrameHeight,
-                                      kAnalysisFrameWidth, CV_8UC1);
-    
-    // Fill the polygon in the mask of the search region.
-    cv::fillPoly(mask_img, searchroi_coors_, cv::Scalar(255));
-    
-    // AND the binary image with the mask and store result into points image.
-    cv::bitwise_and(frame, mask_img, points_img);
-    
-    // Our points are non-zero; store them back to the points attribute.
-    cv::findNonZero(points_img, points_);
+    runs_.clear();
+    table_->moments_[row_] = sums.band_moments(search_band());
+    boundingbox_stale_ = true;
 }
 
 // Operation:
-//   Sets center-of-mass coordinate using points_ attribute.
-void Wave::update_centroid()
+//   Returns the summary of the wave.  The last centroid is the newest one in
+//   the history from a frame in which the wave had pixels.
+WaveSummary Wave::summarize() const
 {
-    centroid_ = {-1,-1};
-
-    if (!points_.empty()){
-        int sum_x = 0;
-        int sum_y = 0;
-        
-        for (std::vector<cv::Point>::size_type i = 0; i != points_.size(); ++i)
+    const RingBuffer<cv::Point, kTrackingHistory>& history =
+            table_->centroid_history_[row_];
+    
+    WaveSummary summary;
+    summary.name = name_;
+    summary.birth = birth_;
+    summary.death = death();
+    summary.max_mass = max_mass();
+    summary.max_displacement = max_displacement();
+    summary.recognized = recognized();
+    
+    // The original axis passes through the centroid at birth, and meets the
+    // y-axis at its band intercept.
+    summary.birth_intercept = static_cast<int>(table_->axis_c_[row_]);
+    
+    cv::Point last = history.empty() ? centroid() : history.back();
+    for (int i = history.size() - 1; i >= 0; --i)
+    {
+        if (history[i].x > -1 && history[i].y > -1)
         {
-            sum_x += points_[i].x;
-            sum_y += points_[i].y;
+            last = history[i];
+            break;
         }
-        
-        centroid_.x = int(sum_x / points_.size());
-        centroid_.y = int(sum_y / points_.size());
     }
+    summary.last_centroid_x = last.x;
+    summary.last_centroid_y = last.y;
     
-    // Update wave.centroid_vec.
-    centroid_vec_.push_back(centroid_);
-    
-    // Pop and discard if the deque exceeds the TrackingHistory constant.
-    if (centroid_vec_.size() > kTrackingHistory)
-         centroid_vec_.erase(centroid_vec_.begin());
+    int lifetime = (summary.death != -1 ? summary.death : birth_) - birth_;
+    summary.mean_velocity = lifetime > 0 ?
+            static_cast<double>(BandIntercept(last.x, last.y) -
+                                summary.birth_intercept) / lifetime : 0.0;
+    return summary;
 }
 
+// Args:
+//   mode: method of computing the box
 // Operation:
-//   Sets the four coordinates of a polygon bounding a wave's points_.
-void Wave::update_boundingbox_coors()
+//   Sets the four coordinates of a polygon bounding a wave's pixels.  The
+//   exact mode requires the runs to have been kept by UpdateAllPoints().
+void Wave::compute_boundingbox_coors(BoxMode mode)
 {
-    if (!points_.empty())
+    const PixelMoments& moments = table_->moments_[row_];
+    
+    if (mode == kMomentBox && moments.m00 != 0)
     {
-        // Calculate means.
-        int sum_x = 0, sum_y = 0;
+        // Central second-order moments, normalized to a covariance.
+        double mean_x = static_cast<double>(moments.m10) / moments.m00;
+        double mean_y = static_cast<double>(moments.m01) / moments.m00;
+        double cov_xx = moments.m20 / static_cast<double>(moments.m00) -
+                        mean_x*mean_x;
+        double cov_xy = moments.m11 / static_cast<double>(moments.m00) -
+                        mean_x*mean_y;
+        double cov_yy = moments.m02 / static_cast<double>(moments.m00) -
+                        mean_y*mean_y;
         
-        for (std::vector<cv::Point>::size_type i = 0; i != points_.size(); ++i)
-        {
-            sum_x += points_[i].x;
-            sum_y += points_[i].y;
-        }
+        // Eigenvalues of the covariance, and the angle of the major axis.
+        double half_trace = 0.5*(cov_xx + cov_yy);
+        double root = std::sqrt(0.25*std::pow(cov_xx - cov_yy, 2) +
+                                cov_xy*cov_xy);
+        double var_major = std::max(half_trace + root, 0.0);
+        double var_minor = std::max(half_trace - root, 0.0);
+        double angle = 0.5*std::atan2(2*cov_xy, cov_xx - cov_yy);
         
-        double mean_x = sum_x / points_.size();
-        double mean_y = sum_y / points_.size();
+        // The box spans three standard deviations either side of the mean.
+        cv::RotatedRect rect(cv::Point2f(mean_x, mean_y),
+                             cv::Size2f(6*std::sqrt(var_major),
+                                        6*std::sqrt(var_minor)),
+                             angle*180.0/3.14159265);
+        rect.points(boundingbox_coors_);
+        has_boundingbox_ = true;
+    }
+    else if (mode == kExactBox && !runs_.empty())
+    {
+        // Calculate means, in floating point as for the moment box.
+        double mean_x = static_cast<double>(moments.m10) / moments.m00;
+        double mean_y = static_cast<double>(moments.m01) / moments.m00;
         
-        // Calculate Standard Deviations.
-        double e_x = 0, e_y = 0;
-
-        for (std::vector<cv::Point>::size_type i = 0; i != points_.size(); ++i)
-        {
-            e_x += std::pow(points_[i].x - mean_x, 2);
-            e_y += std::pow(points_[i].y - mean_y, 2);
-        }
-        double inv = 1.0 / static_cast<double>(points_.size());
+        // Calculate Standard Deviations from the second-order moments.
+        double e_x = moments.m20 - 2*mean_x*moments.m10 +
+                     moments.m00*mean_x*mean_x;
+        double e_y = moments.m02 - 2*mean_y*moments.m01 +
+                     moments.m00*mean_y*mean_y;
+        double inv = 1.0 / static_cast<double>(moments.m00);
 
         double std_x = std::sqrt(inv*e_x);
         double std_y = std::sqrt(inv*e_y);
         
-        // Keep non-outliers (i.e. discard the outliers).
+        // Keep non-outliers (i.e. discard the outliers) by clipping each run to
+        // the inlier columns.  The ends of the clipped runs have the same
+        // convex hull as all of their pixels, so they are all we keep.
         std::vector<cv::Point> points_wo_outliers;
+        int x_min = static_cast<int>(std::ceil(mean_x - 3*std_x));
+        int x_max = static_cast<int>(std::floor(mean_x + 3*std_x));
         
-        for (std::vector<cv::Point>::size_type i = 0; i != points_.size(); ++i)
+        for (std::vector<PixelRun>::size_type i = 0; i != runs_.size(); ++i)
         {
-            if (std::abs(points_[i].x - mean_x) <= 3*std_x &&
-                std::abs(points_[i].y - mean_y) <= 3*std_y)
-                points_wo_outliers.push_back(points_[i]);
+            if (std::abs(runs_[i].y - mean_y) > 3*std_y)
+                continue;
+            
+            int first = std::max(runs_[i].x_begin, x_min);
+            int last = std::min(runs_[i].x_end - 1, x_max);
+            if (first > last)
+                continue;
+            
+            points_wo_outliers.push_back(cv::Point(first, runs_[i].y));
+            if (last != first)
+                points_wo_outliers.push_back(cv::Point(last, runs_[i].y));
         }
         
         // Finds the rectangle that encloses these points.
+        if (points_wo_outliers.empty())
+            return;
         cv::RotatedRect rect = cv::minAreaRect(points_wo_outliers);
         
         // Returns the four coordinates of this bounding rectangle.
-        cv::boxPoints(rect, boundingbox_coors_);
+        rect.points(boundingbox_coors_);
+        has_boundingbox_ = true;
     }
 }
 
+// Args:
+//   mode: method of computing the box
 // Operation:
-//   Updates displacement_, max_displacement_, and displacement_vec_.
-void Wave::update_displacement()
+//   Returns the corners of the bounding box of the current representation,
+//   computing it only if it has not yet been computed by this method since
+//   the representation was last updated.  Returns null if the wave has never had a box.
+const cv::Point2f* Wave::boundingbox_coors(BoxMode mode)
 {
-    if (centroid_.x > -1 && centroid_.y > -1)
+    if (boundingbox_stale_ || boundingbox_mode_ != mode)
     {
-        // Evaluate displacement from original axis.
-        displacement_ = std::abs(original_axis_[0]*centroid_.x +
-                                 original_axis_[1]*centroid_.y +
-                                 original_axis_[2]) /
-                       (std::sqrt(std::pow(original_axis_[0],2) +
-                                  std::pow(original_axis_[1],2)));
+        compute_boundingbox_coors(mode);
+        boundingbox_stale_ = false;
+        boundingbox_mode_ = mode;
+    }
+    return has_boundingbox_ ? boundingbox_coors_ : 0;
+}
+
+
+//---WAVE POOL---
+
+// Args:
+//   section: a detected section
+// Operation:
+//   Constructs a wave in the most recently freed slot, or in a new slot if
+//   none is free, and appends the slot to the live waves and the wave's state
+//   to the table, at the same index.
+WaveHandle WavePool::create(const Section& section)
+{
+    int row = table_.append(section);
+    int slot;
+    if (!free_slots_.empty())
+    {
+        slot = free_slots_.back();
+        free_slots_.pop_back();
+        slots_[slot].reset(section, &table_, row);
+    } else {
+        slot = static_cast<int>(slots_.size());
+        slots_.emplace_back(section, &table_, row);
+        generations_.push_back(0);
+        live_position_.push_back(-1);
     }
     
-    // Update max displacement.
-    if (displacement_ > max_displacement_)
-        max_displacement_ = displacement_;
-    
-    // Update displacement vector.
-    displacement_vec_.push_back(displacement_);
+    live_position_[slot] = static_cast<int>(live_.size());
+    live_.push_back(slot);
     
-    // Pop and discard if the deque exceeds the TrackingHistory constant,
-    if (displacement_vec_.size() > kTrackingHistory)
-        displacement_vec_.erase(displacement_vec_.begin());
+    WaveHandle handle = {slot, generations_[slot]};
+    return handle;
 }
 
+// Args:
+//   handle: a handle to a wave in the pool
 // Operation:
-//   Updates mass_ and max_mass_ by evaluating points_.
-void Wave::update_mass()
+//   Moves the last live wave's slot and row into the destroyed wave's place in
+//   the live waves and the table, advances the slot's generation, and frees
+//   the slot.  The wave's state stays in its slot, for reuse by the next wave
+//   born into it.
+void WavePool::destroy(WaveHandle handle)
 {
-    // Update instantaneous mass.
-    if (!points_.empty())
-        mass_ = static_cast<int>(points_.size());
-    else
-        mass_ = 0;
+    if (get(handle) == 0) {return;}
     
-    // Update maximum mass.
-    if (mass_ > max_mass_)
-        max_mass_ = mass_;
+    int position = live_position_[handle.slot];
+    int last = live_.back();
+    live_[position] = last;
+    live_position_[last] = position;
+    live_.pop_back();
+    table_.remove(position);
+    slots_[last].row_ = position;
+    
+    live_position_[handle.slot] = -1;
+    ++generations_[handle.slot];
+    free_slots_.push_back(handle.slot);
 }
 
+// Args:
+//   handle: a handle to a wave in the pool
 // Operation:
-//   Updates recognized_ by evaluating max_displacement_ and max_mass_.
-void Wave::update_recognized()
+//   Returns the wave if the handle's slot is live and of the same generation.
+Wave* WavePool::get(WaveHandle handle)
 {
-    if (!recognized_ &&
-        max_displacement_ >= kDisplacementThreshold &&
-        max_mass_ >= kMassThreshold)
-        recognized_ = true;
-};
+    const WavePool& pool = *this;
+    return const_cast<Wave*>(pool.get(handle));
+}
+
+const Wave* WavePool::get(WaveHandle handle) const
+{
+    if (handle.slot < 0 || handle.slot >= capacity() ||
+        live_position_[handle.slot] == -1 ||
+        generations_[handle.slot] != handle.generation)
+        return 0;
+    return &slots_[handle.slot];
+}
+
+// Args:
+//   i: index of a live wave
+// Operation:
+//   Returns the handle of the live wave.
+WaveHandle WavePool::handle(int i) const
+{
+    WaveHandle handle = {live_[i], generations_[live_[i]]};
+    return handle;
+}
+
+//---BATCHED UPDATES---
+
+// Args:
+//   waves: a reference to a pool of waves with updated search ROIs
+//   frame: the binary image of the current frame
+//   buffers: storage reused from the previous call
+//   keep_runs: whether the waves keep their runs
+// Operation:
+//   Resets the representation of every wave, then sweeps the search bands of
+//   the waves down the frame in order of their start (See: SweepBands).
+//   Large frames are swept in horizontal stripes on the thread pool; the
+//   first stripe accumulates into the waves directly, and the moments and
+//   runs of the others are added to the waves in stripe order.  Results are
+//   identical to scanning each wave's band on its own, however the frame is
+//   split.
+void UpdateAllPoints(WavePool& waves, const cv::Mat& frame,
+                     SweepBuffers& buffers, bool keep_runs)
+{
+    std::vector<BandSweep>& sweeps = buffers.sweeps;
+    std::vector<SweepStripe>& stripes = buffers.stripes;
+    
+    int num_waves = waves.size();
+    sweeps.clear();
+    
+    for (int i = 0; i != num_waves; ++i)
+    {
+        waves[i].runs_.clear();
+        waves.table().moments_[i] = PixelMoments();
+        waves[i].boundingbox_stale_ = true;
+        
+        BandSweep sweep;
+        sweep.band = waves[i].search_band();
+        sweep.row_begin = std::max(0, sweep.band.start -
+                                      BandIntercept(frame.cols - 1, 0));
+        sweep.row_end = std::min(frame.rows, sweep.band.end);
+        sweep.wave = i;
+        if (sweep.row_begin < sweep.row_end)
+            sweeps.push_back(sweep);
+    }
+    
+    // Bands are sorted by start, so bands also begin in row order, and the
+    // spans of the active bands on any row are sorted by their first column.
+    std::sort(sweeps.begin(), sweeps.end(), CompareBandStart);
+    
+    int num_stripes = sweeps.empty() ? 1 : NumStripes(frame);
+    stripes.resize(num_stripes);
+    
+    for (int t = 0; t != num_stripes; ++t)
+    {
+        SweepStripe& stripe = stripes[t];
+        stripe.row_begin = frame.rows*t / num_stripes;
+        stripe.row_end = frame.rows*(t + 1) / num_stripes;
+        stripe.moments_out.resize(num_waves);
+        stripe.runs_out.resize(keep_runs ? num_waves : 0);
+        if (t != 0)
+        {
+            stripe.moments.assign(num_waves, PixelMoments());
+            stripe.runs.resize(keep_runs ? num_waves : 0);
+        }
+        
+        for (int i = 0; i != num_waves; ++i)
+        {
+            stripe.moments_out[i] = t == 0 ? &waves.table().moments_[i] :
+                                             &stripe.moments[i];
+            if (keep_runs)
+            {
+                if (t != 0) {stripe.runs[i].clear();}
+                stripe.runs_out[i] = t == 0 ? &waves[i].runs_ :
+                                              &stripe.runs[i];
+            }
+        }
+    }
+    
+    if (num_stripes == 1)
+    {
+        SweepBands(sweeps, frame, stripes[0]);
+        return;
+    }
+    
+    cv::parallel_for_(cv::Range(0, num_stripes),
+                      StripeSweeper(sweeps, frame, stripes));
+    
+    for (int t = 1; t != num_stripes; ++t)
+    {
+        for (int i = 0; i != num_waves; ++i)
+        {
+            waves.table().moments_[i].add(stripes[t].moments[i]);
+            if (keep_runs)
+                waves[i].runs_.insert(waves[i].runs_.end(),
+                                      stripes[t].runs[i].begin(),
+                                      stripes[t].runs[i].end());
+        }
+    }
+}
 
 }   //namespace wave_obj
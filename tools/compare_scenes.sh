@@ -0,0 +1,143 @@
+#!/bin/sh
+#
+#  file:       compare_scenes.sh
+#
+#  project:    Multiple Wave Tracking
+#
+#  contents:   Checks that the shortcuts taken by the detection routine leave
+#              the recognized waves unchanged.  Runs the Multiple Wave
+#              Tracking program headless on each scene, once with reference
+#              options that detect over the whole frame on every frame and
+#              once for each set of options under test.  The number of waves
+#              found must be the same, and, reading the archive of each run
+#              with mwt_archive, the birth frames of the recognized waves, in
+#              order, must each be within a tolerance of the reference ones.
+#              Exits with status 1 if any check fails.  Then reports the
+#              per-stage cost of each bounding box mode.
+#
+#  use:        compare_scenes.sh <mwt_cpp> [scene ...]
+#              Scenes default to the videos in scenes/.  mwt_archive is
+#              expected in the directory of mwt_cpp, where the build puts it.
+#
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 <mwt_cpp> [scene ...]" >&2
+    exit 2
+fi
+
+program=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+archive_tool=$(dirname "$program")/mwt_archive
+shift
+root=$(cd "$(dirname "$0")/.." && pwd)
+if [ $# -eq 0 ]; then
+    set -- "$root"/scenes/*.mp4
+fi
+if [ ! -x "$archive_tool" ]; then
+    echo "$0: $archive_tool not found" >&2
+    exit 2
+fi
+
+# Every run works in a directory of its own, so runs never share an archive.
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# Options of the reference run: detection over the whole frame, every frame.
+reference_options="--no-claims --detection-cadence 1"
+
+# Args:
+#   out: path prefix of the results of the run
+#   scene: absolute path of a video
+#   options: options to run the program with
+# Operation:
+#   Runs the program headless on the scene.  Writes the number of waves found
+#   to out.count, and the birth frames of the recognized waves in its archive,
+#   sorted, to out.births.
+run() {
+    out=$1
+    scene=$2
+    shift 2
+    dir=$(mktemp -d "$work/run.XXXXXX")
+    (cd "$dir" && "$program" --headless "$@" "$scene") |
+        sed -n 's/^\([0-9][0-9]*\) wave(s) found\.$/\1/p' > "$out.count"
+    "$archive_tool" "$dir/waves.mwta" | sed 1d | cut -d, -f2 | sort -n \
+        > "$out.births"
+}
+
+# Args:
+#   tolerance: frames by which a birth may differ from the reference
+#   options: options under test
+# Operation:
+#   Runs the current scene with the options, and compares the number of waves
+#   found and their birth frames to those of the reference run.  Records any
+#   difference beyond the tolerance in status.
+check() {
+    tolerance=$1
+    shift
+    run "$work/test" "$scene" "$@"
+    found=$(cat "$work/test.count")
+    
+    # Pair the births in order, and find the largest difference, or "none" if
+    # the numbers of births differ.
+    offset=$(paste -d ' ' "$work/reference.births" "$work/test.births" |
+             awk 'NF != 2 {unpaired = 1}
+                  {d = $2 - $1; if (d < 0) d = -d; if (d > max) max = d}
+                  END {if (unpaired) print "none"; else print max + 0}')
+    
+    if [ -n "$found" ] && [ "$found" = "$reference" ] &&
+       [ "$offset" != "none" ] && [ "$offset" -le "$tolerance" ]; then
+        result="same"
+    else
+        result="DIFFERENT"
+        status=1
+    fi
+    if [ "$offset" = "none" ]; then
+        births="births unpaired"
+    else
+        births="births off by up to $offset frame(s)"
+    fi
+    echo "  [$*] $found wave(s), $births (tolerance $tolerance): $result"
+}
+
+status=0
+for scene in "$@"; do
+    scene=$(cd "$(dirname "$scene")" && pwd)/$(basename "$scene")
+    run "$work/reference" "$scene" $reference_options
+    reference=$(cat "$work/reference.count")
+    echo "$(basename "$scene"): $reference wave(s) with [$reference_options]"
+    if [ -z "$reference" ]; then
+        status=1
+        continue
+    fi
+
+    # Claimed bands change nothing that is promoted, so births must match.
+    # A cadence of N may find a wave up to N - 1 frames late.
+    check 0
+    check 4 --detection-cadence 5
+done
+
+# Args:
+#   scene: absolute path of a video
+#   box_mode: exact or moment
+# Operation:
+#   Prints the tracking and output stage timings, and the output cost per
+#   box, of a run that writes the output video with the given box mode.
+#   Tracking always sweeps the search bands, as exact boxes need the pixel
+#   runs the sweep finds, so that only the box mode differs between runs.
+box_timings() {
+    dir=$(mktemp -d "$work/run.XXXXXX")
+    echo "  --box-mode $2:"
+    (cd "$dir" && "$program" --no-archive --band-sums off --box-mode "$2" \
+        "$1") |
+        grep -E "^  (track|output):|bounding box"
+}
+
+# Compare the cost of exact and moment bounding boxes, with the same tracking
+# path in both.
+echo "Bounding box timings:"
+for scene in "$@"; do
+    scene=$(cd "$(dirname "$scene")" && pwd)/$(basename "$scene")
+    echo "$(basename "$scene"):"
+    box_timings "$scene" exact
+    box_timings "$scene" moment
+done
+exit $status
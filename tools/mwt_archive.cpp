@@ -0,0 +1,46 @@
+//
+//  file:       mwt_archive.cpp
+//
+//  project:    Multiple Wave Tracking
+//
+//  contents:   Command line reader for wave archives written by the Multiple
+//              Wave Tracking program.  Prints the summary of each recognized
+//              wave in an archive as comma-separated values.
+//
+//  use:        mwt_archive <archive>
+//
+
+#include <iostream>
+
+#include "archive.hpp"
+
+
+int main(int argc, const char** argv)
+{
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <archive>" << std::endl;
+        return -1;
+    }
+
+    archive::ArchiveReader reader(argv[1]);
+    if (!reader.is_open()) {
+        std::cerr << "Error opening wave archive " << argv[1] << "."
+                  << std::endl;
+        return -1;
+    }
+
+    std::cout << "name,birth,death,max_mass,max_displacement,recognized,"
+                 "birth_intercept,last_centroid_x,last_centroid_y,"
+                 "mean_velocity" << std::endl;
+
+    for (int i = 0; i != reader.size(); ++i)
+    {
+        wave_obj::WaveSummary wave = reader.at(i);
+        std::cout << wave.name << ',' << wave.birth << ',' << wave.death << ','
+                  << wave.max_mass << ',' << wave.max_displacement << ','
+                  << wave.recognized << ',' << wave.birth_intercept << ','
+                  << wave.last_centroid_x << ',' << wave.last_centroid_y << ','
+                  << wave.mean_velocity << std::endl;
+    }
+    return 0;
+}
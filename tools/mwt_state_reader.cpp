@@ -0,0 +1,49 @@
+//
+//  file:       mwt_state_reader.cpp
+//
+//  project:    Multiple Wave Tracking
+//
+//  contents:   Command line reader for the live state published by the
+//              Multiple Wave Tracking program.  Prints the latest snapshot of
+//              the tracked waves as comma-separated values.
+//
+//  use:        mwt_state_reader [segment]
+//
+
+#include <iostream>
+
+#include "shared_state.hpp"
+
+
+int main(int argc, const char** argv)
+{
+    if (argc > 2) {
+        std::cerr << "Usage: " << argv[0] << " [segment]" << std::endl;
+        return -1;
+    }
+    std::string name = argc == 2 ? argv[1] : "/mwt_state";
+
+    shared_state::StateReader reader(name);
+    if (!reader.is_open()) {
+        std::cerr << "Error opening shared state " << name << "."
+                  << std::endl;
+        return -1;
+    }
+
+    shared_state::Snapshot snapshot;
+    if (!reader.read(snapshot)) {
+        std::cerr << "Error reading a consistent snapshot." << std::endl;
+        return -1;
+    }
+
+    std::cout << "frame,name,centroid_x,centroid_y,mass,recognized"
+              << std::endl;
+    for (int i = 0; i != snapshot.num_waves; ++i)
+    {
+        const shared_state::WaveState& wave = snapshot.waves[i];
+        std::cout << snapshot.frame << ',' << wave.name << ','
+                  << wave.centroid_x << ',' << wave.centroid_y << ','
+                  << wave.mass << ',' << wave.recognized << std::endl;
+    }
+    return 0;
+}